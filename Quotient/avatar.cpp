@@ -8,13 +8,93 @@
 
 #include "jobs/mediathumbnailjob.h"
 
+#include <QtCore/QCache>
 #include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QStringBuilder>
+#include <QtGui/QImageReader>
 #include <QtGui/QPainter>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
 
 using namespace Quotient;
 
+namespace {
+QString imageKey(const QUrl& url, QSize size)
+{
+    return url.toString() % u'#' % QString::number(size.width()) % u'x'
+           % QString::number(size.height());
+}
+
+//! \brief Decoded and scaled avatar images shared by all Avatar objects
+//!
+//! Images are keyed by the mxc URL and the requested size (originals have an invalid
+//! size); least recently used ones are dropped once the total size of images exceeds
+//! the budget. Both the main thread and decoding workers access the cache.
+class {
+public:
+    QImage find(const QString& key)
+    {
+        const QMutexLocker _(&mutex);
+        const auto* image = cache.object(key);
+        return image ? *image : QImage();
+    }
+
+    //! \brief The number of times the images for \p url have been removed
+    //!
+    //! Workers take it before reading the file and pass it to insert(), so that images
+    //! decoded from a file replaced in the meantime don't get into the cache.
+    quint64 generation(const QUrl& url)
+    {
+        const QMutexLocker _(&mutex);
+        return generations.value(url.toString());
+    }
+
+    void insert(const QUrl& url, quint64 generation, QSize size, const QImage& image)
+    {
+        const QMutexLocker _(&mutex);
+        if (generations.value(url.toString()) != generation)
+            return;
+        cache.insert(imageKey(url, size), new QImage(image),
+                     std::max(qsizetype(1), image.sizeInBytes() / 1024));
+    }
+
+    void removeAll(const QUrl& url)
+    {
+        const QString prefix = url.toString() % u'#';
+        const QMutexLocker _(&mutex);
+        ++generations[url.toString()];
+        for (const auto& k : cache.keys())
+            if (k.startsWith(prefix))
+                cache.remove(k);
+    }
+
+private:
+    QMutex mutex;
+    QCache<QString, QImage> cache{ 64 * 1024 }; // In KiB
+    QHash<QString, quint64> generations;
+} imageCache;
+
+//! Decode the avatar (unless the original is cached already) and scale it; runs on workers
+QImage loadScaledAvatar(const QUrl& url, const QString& filePath, QSize size)
+{
+    const auto generation = imageCache.generation(url);
+    auto original = imageCache.find(imageKey(url, {}));
+    if (original.isNull()) {
+        if (!original.load(filePath))
+            return {};
+        imageCache.insert(url, generation, {}, original);
+    }
+    auto scaled = original.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    imageCache.insert(url, generation, size, scaled);
+    return scaled;
+}
+} // anonymous namespace
+
 class Q_DECL_HIDDEN Avatar::Private : public QObject {
 public:
     explicit Private(QUrl url = {}) : _url(std::move(url)) {}
@@ -25,9 +105,9 @@ public:
     }
     Q_DISABLE_COPY_MOVE(Private)
 
-    QImage get(Connection* connection, QSize size,
-               get_callback_t callback) const;
+    QImage get(Connection* connection, QSize size, get_callback_t callback);
     void thumbnailRequestFinished();
+    void scaledImageReady(const QUrl& url, QSize size, const QImage& image);
 
     bool checkUrl(const QUrl& url) const;
     QString localFile() const;
@@ -35,13 +115,13 @@ public:
     QUrl _url;
 
     // The below are related to image caching, hence mutable
-    mutable QImage _originalImage;
-    mutable std::vector<std::pair<QSize, QImage>> _scaledImages;
     mutable QSize _largestRequestedSize{};
     enum ImageSource : quint8 { Unknown, Cache, Network, Invalid };
     mutable ImageSource _imageSource = Unknown;
     mutable JobHandle<MediaThumbnailJob> _thumbnailRequest = nullptr;
     mutable JobHandle<UploadContentJob> _uploadRequest = nullptr;
+    //! Sizes being decoded and scaled on worker threads
+    mutable std::vector<QSize> _pendingSizes{};
     mutable std::vector<get_callback_t> callbacks{};
 };
 
@@ -94,11 +174,14 @@ QFuture<QUrl> Avatar::upload(Connection* connection, QIODevice* source) const
 QString Avatar::mediaId() const { return d->_url.authority() + d->_url.path(); }
 
 QImage Avatar::Private::get(Connection* connection, QSize size,
-                            get_callback_t callback) const
+                            get_callback_t callback)
 {
-    if (_imageSource == Unknown && _originalImage.load(localFile())) {
-        _imageSource = Cache;
-        _largestRequestedSize = _originalImage.size();
+    if (_imageSource == Unknown) {
+        // Only read the image header here; decoding is left to worker threads
+        if (const QImageReader reader(localFile()); reader.canRead()) {
+            _imageSource = Cache;
+            _largestRequestedSize = reader.size();
+        }
     }
 
     // Assuming that all thumbnails for this avatar have the same aspect ratio,
@@ -122,24 +205,45 @@ QImage Avatar::Private::get(Connection* connection, QSize size,
         // The result of this request will only be returned when get() is
         // called next time afterwards
     }
-    if (_imageSource == Invalid || _originalImage.isNull())
+    if (_imageSource == Invalid || _imageSource == Unknown)
         return {};
 
-    // NB: because of KeepAspectRatio, scaledImage.size() might not be equal to
-    // requestedSize - this is why requestedSize is stored separately
-    for (const auto& [requestedSize, scaledImage] : _scaledImages)
-        if (requestedSize == size)
-            return scaledImage;
+    // NB: because of KeepAspectRatio, the scaled image size might not be equal to
+    // the requested size - this is why the requested size is a part of the key
+    if (auto image = imageCache.find(imageKey(_url, size)); !image.isNull())
+        return image;
 
-    const auto& result = _originalImage.scaled(size, Qt::KeepAspectRatio,
-                                               Qt::SmoothTransformation);
-    _scaledImages.emplace_back(size, result);
-    return result;
+    // Decode and scale on a worker thread; the callback will be invoked once it's done
+    if (callback)
+        callbacks.emplace_back(std::move(callback));
+    if (std::ranges::find(_pendingSizes, size) == _pendingSizes.cend()) {
+        _pendingSizes.push_back(size);
+        QtConcurrent::run(&loadScaledAvatar, _url, localFile(), size)
+            .then(this, [this, url = _url, size](const QImage& image) {
+                scaledImageReady(url, size, image);
+            });
+    }
+    return {};
+}
+
+void Avatar::Private::scaledImageReady(const QUrl& url, QSize size, const QImage& image)
+{
+    if (url != _url)
+        return; // The avatar has changed in the meantime
+    std::erase(_pendingSizes, size);
+    if (image.isNull()) {
+        qCWarning(MAIN) << "Couldn't load the cached avatar for" << url << "from"
+                        << localFile();
+        _imageSource = Unknown; // Try to get it from the network next time
+        return;
+    }
+    for (const auto& n : std::exchange(callbacks, {}))
+        n();
 }
 
 void Avatar::Private::thumbnailRequestFinished()
 {
-    // NB: The following code preserves _originalImage in case of
+    // NB: The following code preserves the previous image in case of
     // most errors
     switch (_thumbnailRequest->error()) {
     case BaseJob::NoError: break;
@@ -152,24 +256,24 @@ void Avatar::Private::thumbnailRequestFinished()
         // Other errors are likely unrecoverable but just in case,
         // check if there's a previous image to fall back to; if
         // there is, assume that the error is temporary
-        if (_originalImage.isNull())
+        if (_imageSource != Cache)
             _imageSource = Invalid; // Can't do much with the rest
         return;
     }
-    auto&& img = _thumbnailRequest->thumbnail();
-    if (img.format() == QImage::Format_Invalid) {
-        qCWarning(MAIN) << "The request for" << _url
-                        << "was successful but the received image "
-                           "is invalid or unsupported";
+    // Store the image as it came, without decoding and encoding it again; QSaveFile
+    // replaces the file at once, so that workers still decoding it never see it half-written
+    const auto data = _thumbnailRequest->thumbnailData();
+    QSaveFile file(localFile());
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qCWarning(MAIN) << "Couldn't save the avatar for" << _url << "to" << file.fileName();
         return;
     }
     _imageSource = Network;
-    _originalImage = std::move(img);
-    _originalImage.save(localFile());
-    _scaledImages.clear();
-    for (const auto& n : callbacks)
+    // Images scaled from the previous (smaller) original are stale now
+    imageCache.removeAll(_url);
+    _pendingSizes.clear();
+    for (const auto& n : std::exchange(callbacks, {}))
         n();
-    callbacks.clear();
 }
 
 bool Avatar::Private::checkUrl(const QUrl& url) const
@@ -190,7 +294,7 @@ bool Avatar::Private::checkUrl(const QUrl& url) const
 QString Avatar::Private::localFile() const
 {
     static const auto cachePath = cacheLocation(QStringLiteral("avatars"));
-    return cachePath % _url.authority() % u'_' % _url.fileName() % ".png"_ls;
+    return cachePath % _url.authority() % u'_' % _url.fileName();
 }
 
 QUrl Avatar::url() const { return d->_url; }
@@ -202,8 +306,8 @@ bool Avatar::updateUrl(const QUrl& newUrl)
 
     d->_url = newUrl;
     d->_imageSource = Private::Unknown;
-    d->_originalImage = {};
-    d->_scaledImages.clear();
+    d->_largestRequestedSize = {};
+    d->_pendingSizes.clear();
     if (isJobPending(d->_thumbnailRequest))
         d->_thumbnailRequest->abandon();
     return true;
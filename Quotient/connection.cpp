@@ -43,8 +43,10 @@
 #include <QtCore/QFile>
 #include <QtCore/QMimeDatabase>
 #include <QtCore/QRegularExpression>
+#include <QtCore/QSaveFile>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QStringBuilder>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtNetwork/QDnsLookup>
 #include <qt6keychain/keychain.h>
 
@@ -72,6 +74,7 @@ Connection::Connection(const QUrl& server, QObject* parent)
     //connect(qApp, &QCoreApplication::aboutToQuit, this, &Connection::saveOlmAccount);
     d->q = this; // All d initialization should occur before this line
     setObjectName(server.toString());
+    connect(&d->roomStateSaveTimer, &QTimer::timeout, this, [this] { d->saveDirtyRoomStates(); });
 }
 
 Connection::Connection(QObject* parent) : Connection({}, parent) {}
@@ -80,6 +83,10 @@ Connection::~Connection()
 {
     qCDebug(MAIN) << "deconstructing connection object for" << userId();
     stopSync();
+    d->saveDirtyRoomStates(); // Don't lose the changes that are yet to be written
+    for (auto* r : std::as_const(d->roomMap))
+        r->saveOutboundMegolmSession();
+    d->cacheWriter.waitForDone();
 }
 
 void Connection::resolveServer(const QString& mxid)
@@ -413,6 +420,10 @@ void Connection::sync(int timeout)
         qCInfo(MAIN) << d->syncJob << "is already running";
         return;
     }
+    if (d->syncDataPending) {
+        qCInfo(MAIN) << "The previous sync response is still being processed";
+        return;
+    }
     if (!isLoggedIn()) {
         qCWarning(MAIN) << "Not logged in, not going to sync";
         return;
@@ -425,7 +436,13 @@ void Connection::sync(int timeout)
     auto job = d->syncJob =
         callApi<SyncJob>(BackgroundRequest, d->data->lastEvent(), filter,
                          timeout);
+    job->setDeferredParsing(d->backgroundSyncParsing);
     connect(job, &SyncJob::success, this, [this, job] {
+        if (job->deferredParsing()) {
+            d->syncJob = nullptr;
+            d->parseSyncInBackground(job->jsonData());
+            return;
+        }
         onSyncSuccess(job->takeData());
         d->syncJob = nullptr;
         emit syncDone();
@@ -438,16 +455,21 @@ void Connection::sync(int timeout)
     connect(job, &SyncJob::failure, this, [this, job] {
         // SyncJob persists with retries on transient errors; if it fails,
         // there's likely something serious enough to stop the loop.
-        stopSync();
-        if (job->error() == BaseJob::Unauthorised) {
-            qCWarning(SYNCJOB)
-                << "Sync job failed with Unauthorised - login expired?";
-            emit loginError(job->errorString(), job->rawDataSample());
-        } else
-            emit syncError(job->errorString(), job->rawDataSample());
+        d->onSyncFailure(job->error(), job->errorString(), job->rawDataSample());
     });
 }
 
+void Connection::Private::onSyncFailure(int errorCode, const QString& errorString,
+                                        const QString& details)
+{
+    q->stopSync();
+    if (errorCode == BaseJob::Unauthorised) {
+        qCWarning(SYNCJOB) << "Sync job failed with Unauthorised - login expired?";
+        emit q->loginError(errorString, details);
+    } else
+        emit q->syncError(errorString, details);
+}
+
 void Connection::syncLoop(int timeout)
 {
     if (d->syncLoopConnection && d->syncTimeout == timeout) {
@@ -495,8 +517,17 @@ void Connection::onSyncSuccess(SyncData&& data, bool fromCache)
     }
     d->consumeToDeviceEvents(data.takeToDeviceEvents());
     d->data->setLastEvent(data.nextBatch());
+    auto accountData = data.takeAccountData();
+    // Room events from this sync should be checked against the push rules from the same sync
+    if (const auto it = std::ranges::find_if(accountData,
+                                             [](const EventPtr& e) {
+                                                 return e->matrixType() == "m.push_rules"_ls;
+                                             });
+        it != accountData.cend())
+        d->pushRuleEvaluator.setRuleset(
+            fromJson<PushRuleset>((*it)->contentJson()["global"_ls]));
     d->consumeRoomData(data.takeRoomData(), fromCache);
-    d->consumeAccountData(data.takeAccountData());
+    d->consumeAccountData(std::move(accountData));
     d->consumePresenceData(data.takePresenceData());
     if(d->encryptionData && d->encryptionData->encryptionUpdateRequired) {
         d->encryptionData->loadOutdatedUserDevices();
@@ -505,6 +536,52 @@ void Connection::onSyncSuccess(SyncData&& data, bool fromCache)
     Q_UNUSED(std::move(data)) // Tell static analysers `data` is consumed now
 }
 
+namespace {
+struct ParsedSyncData {
+    SyncData data;
+    QElapsedTimer sinceParsed;
+};
+}
+
+void Connection::Private::parseSyncInBackground(QJsonObject&& syncJson)
+{
+    syncDataPending = true;
+    QtConcurrent::run([json = std::move(syncJson)] {
+        ParsedSyncData result;
+        result.data.parseJson(json); // Logs the parsing time to PROFILER on its own
+        if (const auto unresolvedRooms = result.data.unresolvedRooms();
+            Q_UNLIKELY(!unresolvedRooms.isEmpty()))
+            qCCritical(MAIN).noquote() << "Rooms missing after processing sync "
+                                          "response, possibly a bug in SyncData: "
+                                       << unresolvedRooms.join(u',');
+        result.sinceParsed.start();
+        return result;
+    }).then(q, [this, generation = syncGeneration](QFuture<ParsedSyncData> f) {
+        if (generation != syncGeneration) {
+            qCDebug(MAIN) << "Sync has been stopped, dropping the parsed sync response";
+            return;
+        }
+        syncDataPending = false;
+        auto [data, sinceParsed] = f.takeResult();
+        if (const auto unresolvedRooms = data.unresolvedRooms(); !unresolvedRooms.isEmpty()) {
+            // Same as SyncJob does for responses parsed in the foreground: the response is
+            // not applied, and the batch token is not advanced
+            onSyncFailure(BaseJob::IncorrectResponse,
+                          tr("Rooms missing after processing sync response"),
+                          unresolvedRooms.join(u','));
+            return;
+        }
+        qCDebug(PROFILER) << "*** Sync response parsed in background waited" << sinceParsed
+                          << "to be applied";
+        QElapsedTimer et;
+        et.start();
+        q->onSyncSuccess(std::move(data));
+        if (et.nsecsElapsed() >= ProfilerMinNsecs)
+            qCDebug(PROFILER) << "*** Sync response applied in" << et;
+        emit q->syncDone();
+    });
+}
+
 void Connection::Private::consumeRoomData(SyncDataList&& roomDataList,
                                           bool fromCache)
 {
@@ -647,6 +724,10 @@ void Connection::stopSync()
             d->syncJob->abandon();
         d->syncJob = nullptr;
     }
+    if (d->syncDataPending) { // Make sure the response being parsed won't be applied
+        ++d->syncGeneration;
+        d->syncDataPending = false;
+    }
 }
 
 QString Connection::nextBatchToken() const { return d->data->lastEvent(); }
@@ -710,8 +791,10 @@ MediaThumbnailJob* Connection::getThumbnail(const QString& mediaId,
                                             RunningPolicy policy)
 {
     auto idParts = splitMediaId(mediaId);
-    return callApi<MediaThumbnailJob>(policy, idParts.front(), idParts.back(),
-                                      requestedSize);
+    return d->getShared<MediaThumbnailJob>(
+        MediaThumbnailJob::makeRequestUrl(d->data->homeserverData(), idParts.front(),
+                                          idParts.back(), requestedSize),
+        policy, idParts.front(), idParts.back(), requestedSize);
 }
 
 MediaThumbnailJob* Connection::getThumbnail(const QUrl& url, QSize requestedSize,
@@ -757,7 +840,10 @@ JobHandle<UploadContentJob> Connection::uploadFile(const QString& fileName,
 BaseJob* Connection::getContent(const QString& mediaId)
 {
     auto idParts = splitMediaId(mediaId);
-    return callApi<DownloadFileJob>(idParts.front(), idParts.back());
+    return d->getShared<DownloadFileJob>(
+        DownloadFileJob::makeRequestUrl(d->data->homeserverData(), idParts.front(),
+                                        idParts.back()),
+        ForegroundRequest, idParts.front(), idParts.back());
 }
 
 BaseJob* Connection::getContent(const QUrl& url)
@@ -769,7 +855,12 @@ DownloadFileJob* Connection::downloadFile(const QUrl& url, const QString& localF
 {
     auto mediaId = url.authority() + url.path();
     auto idParts = splitMediaId(mediaId);
-    return callApi<DownloadFileJob>(idParts.front(), idParts.back(), localFilename);
+    if (!localFilename.isEmpty()) // Each such job writes to its own file
+        return callApi<DownloadFileJob>(idParts.front(), idParts.back(), localFilename);
+    return d->getShared<DownloadFileJob>(
+        DownloadFileJob::makeRequestUrl(d->data->homeserverData(), idParts.front(),
+                                        idParts.back()),
+        ForegroundRequest, idParts.front(), idParts.back());
 }
 
 DownloadFileJob* Connection::downloadFile(
@@ -1150,6 +1241,11 @@ const EventPtr& Connection::accountData(const QString& type) const
     return it == d->accountData.end() ? NoEventPtr : it->second;
 }
 
+const PushRuleEvaluator& Connection::pushRuleEvaluator() const
+{
+    return d->pushRuleEvaluator;
+}
+
 QJsonObject Connection::accountDataJson(const QString& type) const
 {
     const auto& eventPtr = accountData(type);
@@ -1211,6 +1307,8 @@ DirectChatsMap Connection::directChats() const
 // Removes room with given id from roomMap
 void Connection::Private::removeRoom(const QString& roomId)
 {
+    if (auto* store = q->timelineStore())
+        store->enqueueClearRoom(roomId);
     for (auto f : { false, true })
         if (auto r = roomMap.take({ roomId, f })) {
             qCDebug(MAIN) << "Room" << r->objectName() << "in state" << terse
@@ -1437,19 +1535,63 @@ void Connection::saveRoomState(Room* r) const
     if (!d->cacheState)
         return;
 
-    QFile outRoomFile { stateCacheDir().filePath(
-        SyncData::fileNameForRoom(r->id())) };
-    if (outRoomFile.open(QFile::WriteOnly)) {
-        const auto data =
-            d->cacheToBinary
-                ? QCborValue::fromJsonValue(r->toJson()).toCbor()
-                : QJsonDocument(r->toJson()).toJson(QJsonDocument::Compact);
-        outRoomFile.write(data.data(), data.size());
-        qCDebug(MAIN) << "Room state cache saved to" << outRoomFile.fileName();
-    } else {
-        qCWarning(MAIN) << "Error opening" << outRoomFile.fileName() << ":"
-                        << outRoomFile.errorString();
+    d->dirtyRoomIds.insert(r->id());
+    if (!d->roomStateSaveTimer.isActive())
+        d->roomStateSaveTimer.start();
+}
+
+void Connection::Private::saveDirtyRoomStates()
+{
+    roomStateSaveTimer.stop();
+    if (dirtyRoomIds.isEmpty())
+        return;
+
+    QElapsedTimer et;
+    et.start();
+    const auto cacheDir = q->stateCacheDir();
+    auto* const store = q->timelineStore();
+    std::vector<TimelineStore::Writes> timelineWrites;
+    for (const auto& roomId : std::as_const(dirtyRoomIds)) {
+        auto* r = roomMap.value({ roomId, false }, nullptr);
+        if (!r)
+            r = roomMap.value({ roomId, true }, nullptr);
+        if (!r) // The room has been forgotten in the meantime
+            continue;
+        writeCacheFile(cacheDir.filePath(SyncData::fileNameForRoom(roomId)), r->toJson());
+        if (store)
+            if (auto writes = r->prepareCachedTimeline(*store, timelineCacheSize))
+                timelineWrites.push_back(std::move(writes));
     }
+    if (!timelineWrites.empty())
+        store->enqueueWrites([timelineWrites = std::move(timelineWrites)](TimelineStore& s) {
+            s.transaction();
+            for (const auto& writes : timelineWrites)
+                writes(s);
+            s.commit();
+        });
+    if (dirtyRoomIds.size() > 9 || et.nsecsElapsed() >= ProfilerMinNsecs)
+        qCDebug(PROFILER) << "*** State of" << dirtyRoomIds.size()
+                          << "room(s) prepared for saving in" << et;
+    dirtyRoomIds.clear();
+}
+
+void Connection::Private::writeCacheFile(const QString& filePath, QJsonObject json)
+{
+    cacheWriter.start([filePath, json = std::move(json), toBinary = cacheToBinary] {
+        const auto data = toBinary ? QCborValue::fromJsonValue(json).toCbor()
+                                   : QJsonDocument(json).toJson(QJsonDocument::Compact);
+        // QSaveFile ensures that a crash midway doesn't leave a truncated file behind
+        QSaveFile outFile{ filePath };
+        if (!outFile.open(QFile::WriteOnly)) {
+            qCWarning(MAIN) << "Error opening" << filePath << ":" << outFile.errorString();
+            return;
+        }
+        outFile.write(data);
+        if (outFile.commit())
+            qCDebug(MAIN) << "State cache saved to" << filePath;
+        else
+            qCWarning(MAIN) << "Error writing" << filePath << ":" << outFile.errorString();
+    });
 }
 
 void Connection::saveState() const
@@ -1460,7 +1602,8 @@ void Connection::saveState() const
     QElapsedTimer et;
     et.start();
 
-    QFile outFile { d->topLevelStatePath() };
+    d->saveDirtyRoomStates();
+    QSaveFile outFile { d->topLevelStatePath() };
     if (!outFile.open(QFile::WriteOnly)) {
         qCWarning(MAIN) << "Error opening" << outFile.fileName() << ":"
                         << outFile.errorString();
@@ -1483,8 +1626,8 @@ void Connection::saveState() const
                 continue;
             (r->joinState() == JoinState::Invite ? inviteRoomsJson : roomsJson)
                 .insert(r->id(),
-                        QJsonObject{ { "$ref"_ls,
-                                       SyncData::fileNameForRoom(r->id()) } });
+                        QJsonObject{ { "$ref"_ls, SyncData::fileNameForRoom(r->id()) },
+                                     { "preview"_ls, r->toPreviewJson() } });
         }
 
         QJsonObject roomObj;
@@ -1519,8 +1662,13 @@ void Connection::saveState() const
                          : QJsonDocument(rootObj).toJson(QJsonDocument::Compact);
     qCDebug(PROFILER) << "Cache for" << userId() << "generated in" << et;
 
+    // Room files referred to from the top-level file should be in place by the time it's written
+    d->cacheWriter.waitForDone();
     outFile.write(data.data(), data.size());
-    qCDebug(MAIN) << "State cache saved to" << outFile.fileName();
+    if (outFile.commit())
+        qCDebug(MAIN) << "State cache saved to" << outFile.fileName();
+    else
+        qCWarning(MAIN) << "Error writing" << outFile.fileName() << ":" << outFile.errorString();
 }
 
 void Connection::loadState()
@@ -1531,7 +1679,7 @@ void Connection::loadState()
     QElapsedTimer et;
     et.start();
 
-    SyncData sync { d->topLevelStatePath() };
+    SyncData sync { d->topLevelStatePath(), !d->deferredStateLoading };
     if (sync.nextBatch().isEmpty()) // No token means no cache by definition
         return;
 
@@ -1568,6 +1716,16 @@ void Connection::setCacheState(bool newValue)
     }
 }
 
+std::chrono::milliseconds Connection::stateSaveInterval() const
+{
+    return d->roomStateSaveTimer.intervalAsDuration();
+}
+
+void Connection::setStateSaveInterval(std::chrono::milliseconds interval)
+{
+    d->roomStateSaveTimer.setInterval(interval);
+}
+
 bool Connection::lazyLoading() const { return d->lazyLoading; }
 
 void Connection::setLazyLoading(bool newValue)
@@ -1578,6 +1736,46 @@ void Connection::setLazyLoading(bool newValue)
     }
 }
 
+bool Connection::deferredStateLoading() const { return d->deferredStateLoading; }
+
+void Connection::setDeferredStateLoading(bool newValue)
+{
+    if (d->deferredStateLoading != newValue) {
+        d->deferredStateLoading = newValue;
+        emit deferredStateLoadingChanged();
+    }
+}
+
+bool Connection::backgroundSyncParsing() const { return d->backgroundSyncParsing; }
+
+void Connection::setBackgroundSyncParsing(bool newValue)
+{
+    if (d->backgroundSyncParsing != newValue) {
+        d->backgroundSyncParsing = newValue;
+        emit backgroundSyncParsingChanged();
+    }
+}
+
+int Connection::timelineCacheSize() const { return d->timelineCacheSize; }
+
+void Connection::setTimelineCacheSize(int newValue)
+{
+    if (d->timelineCacheSize != newValue) {
+        d->timelineCacheSize = newValue;
+        emit timelineCacheSizeChanged();
+    }
+}
+
+int Connection::timelineSizeLimit() const { return d->timelineSizeLimit; }
+
+void Connection::setTimelineSizeLimit(int newValue)
+{
+    if (d->timelineSizeLimit != newValue) {
+        d->timelineSizeLimit = newValue;
+        emit timelineSizeLimitChanged();
+    }
+}
+
 BaseJob* Connection::run(BaseJob* job, RunningPolicy runningPolicy)
 {
     // Reparent to protect from #397, #398 and to prevent BaseJob* from being
@@ -1752,11 +1950,27 @@ Database* Connection::database() const
     return d->encryptionData ? &d->encryptionData->database : nullptr;
 }
 
+TimelineStore* Connection::timelineStore() const
+{
+    if (!d->cacheState || d->timelineCacheSize <= 0 || userId().isEmpty())
+        return nullptr;
+    if (!d->timelineStore)
+        d->timelineStore = std::make_unique<TimelineStore>(
+            stateCacheDir().filePath("timeline.db3"_ls), "QuotientTimeline_"_ls + userId());
+    return d->timelineStore.get();
+}
+
 std::unordered_map<QByteArray, QOlmInboundGroupSession> Connection::loadRoomMegolmSessions(const Room* room) const
 {
     return database()->loadMegolmSessions(room->id());
 }
 
+std::optional<QOlmInboundGroupSession> Connection::loadRoomMegolmSession(
+    const Room* room, const QByteArray& sessionId) const
+{
+    return database()->loadMegolmSession(room->id(), sessionId);
+}
+
 void Connection::saveMegolmSession(const Room* room,
                                    const QOlmInboundGroupSession& session, const QByteArray& senderKey, const QByteArray& senderEdKey) const
 {
@@ -36,6 +36,7 @@ class Avatar;
 class Room;
 class User;
 class ConnectionData;
+class PushRuleEvaluator;
 class RoomEvent;
 
 class GetVersionsJob;
@@ -52,6 +53,7 @@ class SendToDeviceJob;
 class SendMessageJob;
 class LeaveRoomJob;
 class Database;
+class TimelineStore;
 struct EncryptedFileMetadata;
 
 class QOlmAccount;
@@ -128,6 +130,14 @@ class QUOTIENT_API Connection : public QObject {
     Q_PROPERTY(bool supportsPasswordAuth READ supportsPasswordAuth NOTIFY loginFlowsChanged STORED false)
     Q_PROPERTY(bool cacheState READ cacheState WRITE setCacheState NOTIFY cacheStateChanged)
     Q_PROPERTY(bool lazyLoading READ lazyLoading WRITE setLazyLoading NOTIFY lazyLoadingChanged)
+    Q_PROPERTY(bool deferredStateLoading READ deferredStateLoading WRITE setDeferredStateLoading
+                   NOTIFY deferredStateLoadingChanged)
+    Q_PROPERTY(bool backgroundSyncParsing READ backgroundSyncParsing WRITE setBackgroundSyncParsing
+                   NOTIFY backgroundSyncParsingChanged)
+    Q_PROPERTY(int timelineCacheSize READ timelineCacheSize WRITE setTimelineCacheSize
+                   NOTIFY timelineCacheSizeChanged)
+    Q_PROPERTY(int timelineSizeLimit READ timelineSizeLimit WRITE setTimelineSizeLimit
+                   NOTIFY timelineSizeLimitChanged)
     Q_PROPERTY(bool canChangePassword READ canChangePassword NOTIFY capabilitiesLoaded)
     Q_PROPERTY(bool encryptionEnabled READ encryptionEnabled WRITE enableEncryption NOTIFY encryptionChanged)
     Q_PROPERTY(bool directChatEncryptionEnabled READ directChatEncryptionEnabled WRITE enableDirectChatEncryption NOTIFY directChatsEncryptionChanged)
@@ -217,6 +227,10 @@ public:
     //! Lists the types of account data that exist for this connection;
     QStringList accountDataEventTypes() const;
 
+    //! \brief The push rules of this account, compiled for client-side evaluation
+    //! \sa Room::checkForNotifications
+    const PushRuleEvaluator& pushRuleEvaluator() const;
+
     //! \brief Get all Invited and Joined rooms grouped by tag
     //! \return a hashmap from tag name to a vector of room pointers,
     //!         sorted by their order in the tag - details are at
@@ -328,9 +342,17 @@ public:
     bool isLoggedIn() const;
     QOlmAccount* olmAccount() const;
     Database* database() const;
+    //! \brief The on-disk store of recent timeline events
+    //!
+    //! \return the store, or `nullptr` if the timeline cache is disabled or the connection
+    //!         has not been logged in yet
+    //! \sa timelineCacheSize
+    TimelineStore* timelineStore() const;
 
     std::unordered_map<QByteArray, QOlmInboundGroupSession> loadRoomMegolmSessions(
         const Room* room) const;
+    std::optional<QOlmInboundGroupSession> loadRoomMegolmSession(
+        const Room* room, const QByteArray& sessionId) const;
     void saveMegolmSession(const Room* room,
                            const QOlmInboundGroupSession& session, const QByteArray &senderKey, const QByteArray& senderEdKey) const;
 
@@ -462,7 +484,13 @@ public:
     //! \sa loadState
     Q_INVOKABLE void saveState() const;
 
-    //! This method saves the current state of a single room.
+    //! \brief Schedule saving the current state of a single room
+    //!
+    //! The room is only marked as changed; the states of all changed rooms are written to
+    //! the cache together, on a worker thread, once stateSaveInterval() passes after the first
+    //! change - or when saveState() is called or the connection is destroyed, whichever
+    //! comes first.
+    //! \sa stateSaveInterval, saveState
     void saveRoomState(Room* r) const;
 
     //! \brief Get the default directory path to save the room state to
@@ -486,9 +514,64 @@ public:
     bool cacheState() const;
     void setCacheState(bool newValue);
 
+    //! \brief Whether loadState() should only load room previews
+    //!
+    //! When enabled, loadState() reads only the top-level cache file, where each room has
+    //! a preview with its name, avatar, tags and unread counters; this makes the rooms ready
+    //! to be listed quickly even with thousands of them. The full state of a room is read
+    //! from its cache file when the room is displayed (see Room::setDisplayed()), when a new
+    //! update for it arrives from the server, before sharing a room key with its members, or
+    //! before saving its state; until then, Room::currentState() and the member lists only
+    //! reflect the preview. Disabled by default;
+    //! has no effect on caches saved before libQuotient 0.9, which don't have room previews.
+    //! \sa loadState
+    bool deferredStateLoading() const;
+    void setDeferredStateLoading(bool newValue);
+
+    //! \brief The delay between a change in a room state and writing it to the cache
+    //!
+    //! Changes in rooms that occur within this interval are written together. The default
+    //! is 30 seconds; zero means writing as soon as control returns to the event loop.
+    //! \sa saveRoomState
+    std::chrono::milliseconds stateSaveInterval() const;
+    void setStateSaveInterval(std::chrono::milliseconds interval);
+
     bool lazyLoading() const;
     void setLazyLoading(bool newValue);
 
+    //! \brief Whether /sync responses are parsed on a worker thread
+    //!
+    //! When enabled, turning the JSON of a /sync response into SyncData (including loading
+    //! all the events in it) is done on the global thread pool; only applying the result
+    //! (onSyncSuccess()) happens on the thread of the connection. This keeps the UI responsive
+    //! during initial and catch-up syncs with many rooms. Disabled by default; the setting
+    //! takes effect with the next sync() call.
+    //! \sa sync, syncDone
+    bool backgroundSyncParsing() const;
+    void setBackgroundSyncParsing(bool newValue);
+
+    //! \brief How many most recent timeline events of each room to keep on disk
+    //!
+    //! With a non-zero value (and cacheState() enabled) the newest events of each room are
+    //! stored next to the state cache whenever the room state is saved. After a restart, rooms
+    //! serve Room::getPreviousContent() from the stored events before requesting the server,
+    //! so their history can be shown immediately and offline. Zero (the default) disables
+    //! the timeline cache. Set this before calling loadState().
+    //! \sa timelineStore, saveRoomState
+    int timelineCacheSize() const;
+    void setTimelineCacheSize(int newValue);
+
+    //! \brief The number of events each room keeps in its timeline in memory
+    //!
+    //! When the timeline of a room that is not displayed grows beyond this number, its oldest
+    //! events are removed (see Room::aboutToRemoveHistoricalMessages()); they can be loaded
+    //! again with Room::getPreviousContent(). To make that possible, the timeline is cut at
+    //! the start of a batch received from the server, so it may end up somewhat shorter than
+    //! the limit. Zero (the default) means no limit.
+    //! \sa Room::setDisplayed
+    int timelineSizeLimit() const;
+    void setTimelineSizeLimit(int newValue);
+
     //! Start a pre-created job object on this connection
     Q_INVOKABLE BaseJob* run(BaseJob* job,
                              RunningPolicy runningPolicy = ForegroundRequest);
@@ -673,6 +756,13 @@ public Q_SLOTS:
 
     void stopSync();
 
+    //! \brief Get a thumbnail of the media item
+    //!
+    //! If the same thumbnail is already being fetched, the returned job takes the result
+    //! of the request in flight instead of making another one; this also applies to
+    //! getContent() and to downloadFile() without a local file name. Each caller still
+    //! gets a job of its own and can abandon it without affecting the others.
+    //! \sa ConnectionData::coalescedRequestsCount
     virtual MediaThumbnailJob*
     getThumbnail(const QString& mediaId, QSize requestedSize,
                  RunningPolicy policy = BackgroundRequest);
@@ -896,6 +986,10 @@ Q_SIGNALS:
 
     void cacheStateChanged();
     void lazyLoadingChanged();
+    void deferredStateLoadingChanged();
+    void backgroundSyncParsingChanged();
+    void timelineCacheSizeChanged();
+    void timelineSizeLimitChanged();
     void turnServersChanged(const QJsonObject& servers);
     void devicesListLoaded();
 
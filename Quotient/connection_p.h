@@ -8,8 +8,10 @@
 #include "connection.h"
 #include "connectiondata.h"
 #include "connectionencryptiondata_p.h"
+#include "pushruleevaluator.h"
 #include "settings.h"
 #include "syncdata.h"
+#include "timelinestore.h"
 
 #include "csapi/account-data.h"
 #include "csapi/capabilities.h"
@@ -18,6 +20,8 @@
 #include "csapi/wellknown.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
 
 namespace Quotient {
 
@@ -25,7 +29,11 @@ class Q_DECL_HIDDEN Quotient::Connection::Private {
 public:
     explicit Private(std::unique_ptr<ConnectionData>&& connection)
         : data(std::move(connection))
-    {}
+    {
+        roomStateSaveTimer.setSingleShot(true);
+        roomStateSaveTimer.setInterval(std::chrono::seconds(30));
+        cacheWriter.setMaxThreadCount(1); // Keep the writes in the order they were requested
+    }
 
     Connection* q = nullptr;
     std::unique_ptr<ConnectionData> data;
@@ -48,6 +56,7 @@ public:
     DirectChatsMap dcLocalAdditions;
     DirectChatsMap dcLocalRemovals;
     std::unordered_map<QString, EventPtr> accountData;
+    PushRuleEvaluator pushRuleEvaluator;
     QMetaObject::Connection syncLoopConnection {};
     int syncTimeout = -1;
 
@@ -73,7 +82,20 @@ public:
         SettingsGroup("libQuotient"_ls).get("cache_type"_ls,
                                             SettingsGroup("libQMatrixClient"_ls).get<QString>("cache_type"_ls))
         != "json"_ls;
+    //! Ids of rooms with state changes not yet written to the cache
+    QSet<QString> dirtyRoomIds;
+    QTimer roomStateSaveTimer;
+    QThreadPool cacheWriter;
     bool lazyLoading = false;
+    bool deferredStateLoading = false;
+    bool backgroundSyncParsing = false;
+    //! Whether a /sync response is being parsed in background and not applied yet
+    bool syncDataPending = false;
+    //! Bumped by Connection::stopSync() to drop responses still being parsed in background
+    uint syncGeneration = 0;
+    int timelineCacheSize = 0;
+    int timelineSizeLimit = 0;
+    std::unique_ptr<TimelineStore> timelineStore;
 
     //! \brief Check the homeserver and resolve it if needed, before connecting
     //!
@@ -95,6 +117,9 @@ public:
     void completeSetup(const QString &mxId, bool mock = false);
     void removeRoom(const QString& roomId);
 
+    void parseSyncInBackground(QJsonObject&& syncJson);
+    //! Stop the sync loop after a sync failure and notify clients
+    void onSyncFailure(int errorCode, const QString& errorString, const QString& details);
     void consumeRoomData(SyncDataList&& roomDataList, bool fromCache);
     void consumeAccountData(Events&& accountDataEvents);
     void consumePresenceData(Events&& presenceData);
@@ -115,6 +140,11 @@ public:
         packAndSendAccountData(
             makeEvent<EventT>(std::forward<ContentT>(content)));
     }
+    //! Queue writing the state of rooms in dirtyRoomIds to the cache
+    void saveDirtyRoomStates();
+    //! Serialise \p json and atomically write it to \p filePath using cacheWriter
+    void writeCacheFile(const QString& filePath, QJsonObject json);
+
     QString topLevelStatePath() const
     {
         return q->stateCacheDir().filePath("state.json"_ls);
@@ -122,5 +152,30 @@ public:
 
     void saveAccessTokenToKeychain() const;
     void dropAccessToken();
+
+    //! \brief Start a job for an idempotent GET request to \p requestUrl
+    //!
+    //! Each requester gets a job of its own; if an identical request is already in flight,
+    //! the job takes its result instead of sending another request (see
+    //! ConnectionData::shareInFlightGet()). The request itself is made by a source job that
+    //! is not handed out to anyone.
+    template <typename JobT, typename... JobArgTs>
+    JobT* getShared(const QUrl& requestUrl, RunningPolicy runningPolicy,
+                    const JobArgTs&... jobArgs)
+    {
+        auto* job = new JobT(jobArgs...);
+        // Reparent and connect the same way Connection::run() does
+        job->setParent(q);
+        QObject::connect(job, &BaseJob::failure, q, &Connection::requestFailed);
+        // Different job types use different endpoints, so the URL determines the type
+        // of the source job
+        if (!data->shareInFlightGet(requestUrl, job)) {
+            auto* sourceJob = new JobT(jobArgs...);
+            sourceJob->setParent(q);
+            sourceJob->initiate(data.get(), runningPolicy & BackgroundRequest);
+            data->addInFlightGet(requestUrl, sourceJob, job);
+        }
+        return job;
+    }
 };
 } // namespace Quotient
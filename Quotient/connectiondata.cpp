@@ -9,19 +9,52 @@
 
 #include "jobs/basejob.h"
 
+#include <QtCore/QHash>
 #include <QtCore/QPointer>
+#include <QtCore/QRandomGenerator>
 #include <QtCore/QTimer>
+#include <QtNetwork/QNetworkInformation>
+#include <QtNetwork/QNetworkReply>
 
+#include <algorithm>
 #include <array>
+#include <map>
 #include <queue>
 
 using namespace Quotient;
+using namespace std::chrono_literals;
+using std::chrono::milliseconds, std::chrono::steady_clock;
+
+namespace {
+constexpr milliseconds FirstRetryInterval = 2s;
+constexpr milliseconds MaxRetryInterval = 2min;
+constexpr auto MaxBackoffExponent = 6; // 2s * 2^6 > MaxRetryInterval
+//! The number of requests failing in a row that makes the connection considered offline
+constexpr auto OfflineFailureStreak = 3;
+constexpr auto MaxRetryTokens = 10.0;
+//! Retries may make about 10% of the requests in the long run
+constexpr auto RetryTokensPerSuccess = 0.1;
+
+//! Rate limits are learned for endpoint families rather than for specific endpoints
+//! (e.g., all room sends are limited together); jobs of the same class make a family
+QString endpointFamily(const BaseJob* job)
+{
+    return job->objectName().section(u'-', 0, 0); // Drop the serial number of SyncJob
+}
+
+constexpr milliseconds MinPacingInterval = 100ms;
+constexpr auto MaxPacingBurst = 10.0;
+//! The number of successful requests after which pacing of a family is relaxed
+constexpr auto RelaxPacingAfter = 10;
+} // anonymous namespace
 
 class ConnectionData::Private {
 public:
     explicit Private(QUrl url) : baseUrl(std::move(url))
     {
         rateLimiter.setSingleShot(true);
+        retryTimer.setSingleShot(true);
+        pacer.setSingleShot(true);
     }
 
     QUrl baseUrl;
@@ -40,6 +73,181 @@ public:
     using job_queue_t = std::queue<QPointer<BaseJob>>;
     std::array<job_queue_t, 2> jobs; // 0 - foreground, 1 - background
     QTimer rateLimiter;
+    int maxConcurrentRequests = DefaultMaxConcurrentRequests;
+    std::vector<QPointer<QNetworkReply>> runningRequests;
+
+    //! Jobs waiting for a retry, by the time of the next attempt
+    std::multimap<steady_clock::time_point, QPointer<BaseJob>> retries;
+    QTimer retryTimer;
+    //! The number of requests in a row that failed without reaching the server
+    int failureStreak = 0;
+    double retryTokens = MaxRetryTokens;
+
+    //! \brief Rate limiting state of an endpoint family
+    //!
+    //! Once the server rate-limits a request, further requests of the same family are paced
+    //! with a token bucket: each request takes a token, and tokens are added once per
+    //! `interval`, up to `burst` of them. The interval starts with what the server advised;
+    //! as requests keep succeeding, it gets shorter and the burst gets larger, until the family
+    //! is no more limited.
+    struct EndpointLimit {
+        milliseconds interval = MinPacingInterval;
+        double burst = 1;
+        double tokens = 0;
+        steady_clock::time_point updated = steady_clock::now();
+        int successes = 0; //!< Since the last time the family was rate-limited
+        std::array<job_queue_t, 2> waiting; // 0 - foreground, 1 - background
+
+        void refill(steady_clock::time_point now)
+        {
+            if (now <= updated)
+                return;
+            tokens = std::min(tokens + std::chrono::duration<double>(now - updated) / interval,
+                              burst);
+            updated = now;
+        }
+        steady_clock::time_point nextTokenAt() const
+        {
+            return updated
+                   + std::chrono::ceil<steady_clock::duration>(interval * (1 - tokens));
+        }
+        bool hasWaitingJobs() const
+        {
+            return std::any_of(waiting.cbegin(), waiting.cend(),
+                               [](const auto& q) { return !q.empty(); });
+        }
+    };
+    QHash<QString, EndpointLimit> endpointLimits;
+    QTimer pacer;
+
+    QHash<QUrl, QPointer<BaseJob>> inFlightGets;
+    qsizetype coalescedRequests = 0;
+
+    bool hasFreeSlot()
+    {
+        std::erase_if(runningRequests, [](const auto& r) { return !r || !r->isRunning(); });
+        return maxConcurrentRequests <= 0
+               || std::ssize(runningRequests) < maxConcurrentRequests;
+    }
+
+    void enqueue(BaseJob* job)
+    {
+        jobs[size_t(job->isBackground())].emplace(job);
+        if (!rateLimiter.isActive())
+            rateLimiter.start(0);
+    }
+
+    //! Put the job to the queue, unless its endpoint family is paced and has to wait
+    void admit(BaseJob* job)
+    {
+        const auto it = endpointLimits.find(endpointFamily(job));
+        if (it != endpointLimits.end()) {
+            it->refill(steady_clock::now());
+            if (it->tokens < 1 || it->hasWaitingJobs()) {
+                it->waiting[size_t(job->isBackground())].emplace(job);
+                startPacer();
+                return;
+            }
+            it->tokens -= 1;
+        }
+        enqueue(job);
+    }
+
+    //! Put the jobs of paced endpoint families to the queue, as far as their tokens allow
+    void releasePacedJobs()
+    {
+        const auto now = steady_clock::now();
+        for (auto& limit : endpointLimits) {
+            limit.refill(now);
+            for (auto& q : limit.waiting)
+                while (!q.empty() && limit.tokens >= 1) {
+                    const auto job = q.front();
+                    q.pop();
+                    if (job && job->error() == BaseJob::Pending) {
+                        limit.tokens -= 1;
+                        enqueue(job);
+                    }
+                }
+        }
+        startPacer();
+    }
+
+    void startPacer()
+    {
+        auto nextAt = steady_clock::time_point::max();
+        for (const auto& limit : std::as_const(endpointLimits))
+            if (limit.hasWaitingJobs())
+                nextAt = std::min(nextAt, limit.nextTokenAt());
+        if (nextAt == steady_clock::time_point::max())
+            pacer.stop();
+        else
+            pacer.start(
+                std::max(std::chrono::ceil<milliseconds>(nextAt - steady_clock::now()), 0ms));
+    }
+
+    void sendRequest(BaseJob* job)
+    {
+        job->sendRequest();
+        if (auto* const reply = job->reply(); reply && reply->isRunning()) {
+            runningRequests.emplace_back(reply);
+            QObject::connect(reply, &QNetworkReply::finished, &rateLimiter,
+                             [this, reply, family = endpointFamily(job)] {
+                                 requestFinished(reply, family);
+                             });
+        }
+    }
+
+    void requestFinished(QNetworkReply* reply, const QString& endpointFamily)
+    {
+        std::erase(runningRequests, reply);
+        if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).isValid()) {
+            // The server has been reached, whatever it responded with
+            if (reply->error() == QNetworkReply::NoError) {
+                retryTokens = std::min(retryTokens + RetryTokensPerSuccess, MaxRetryTokens);
+                relaxPacing(endpointFamily);
+            }
+            if (std::exchange(failureStreak, 0) >= OfflineFailureStreak && !retries.empty()) {
+                qCInfo(MAIN) << id() << "is back online, resuming jobs waiting for a retry";
+                resumeRetries(steady_clock::time_point::max());
+            }
+        } else if (reply->error() != QNetworkReply::OperationCanceledError)
+            ++failureStreak;
+
+        if (!rateLimiter.isActive()) // A slot has been freed, take the next job if any
+            rateLimiter.start(0);
+    }
+
+    void relaxPacing(const QString& endpointFamily)
+    {
+        const auto it = endpointLimits.find(endpointFamily);
+        if (it == endpointLimits.end() || ++it->successes % RelaxPacingAfter != 0)
+            return;
+        it->interval = it->interval * 3 / 4;
+        it->burst = std::min(it->burst + 1, MaxPacingBurst);
+        if (it->interval >= MinPacingInterval || it->hasWaitingJobs())
+            return;
+        qCDebug(MAIN) << endpointFamily << "requests in" << id() << "are no more paced";
+        endpointLimits.erase(it);
+    }
+
+    //! Put the jobs due for a retry at \p upTo back to the queue
+    void resumeRetries(steady_clock::time_point upTo)
+    {
+        const auto end = retries.upper_bound(upTo);
+        for (auto it = retries.begin(); it != end; ++it)
+            if (const auto& job = it->second; job && job->error() == BaseJob::Pending) {
+                qCDebug(MAIN) << "Retrying" << job;
+                admit(job);
+            }
+        retries.erase(retries.begin(), end);
+
+        if (retries.empty())
+            retryTimer.stop();
+        else
+            retryTimer.start(std::max(std::chrono::ceil<milliseconds>(retries.begin()->first
+                                                                      - steady_clock::now()),
+                                      0ms));
+    }
 };
 
 ConnectionData::ConnectionData(QUrl baseUrl)
@@ -52,6 +260,12 @@ ConnectionData::ConnectionData(QUrl baseUrl)
     d->rateLimiter.callOnTimeout([this] {
         // TODO: Consider moving out all job->sendRequest() invocations to a dedicated thread
         d->rateLimiter.setInterval(0);
+        if (!d->hasFreeSlot()) {
+            // Resumed by Private::requestFinished() once a running request completes
+            qCDebug(MAIN) << d->id() << "has reached the limit of" << d->maxConcurrentRequests
+                          << "concurrent requests";
+            return;
+        }
         for (auto& q : d->jobs)
             while (!q.empty()) {
                 const auto job = q.front();
@@ -65,31 +279,42 @@ ConnectionData::ConnectionData(QUrl baseUrl)
                     Q_ASSERT(false);
                     job->setStatus(BaseJob::Pending);
                 }
-                job->sendRequest();
+                d->sendRequest(job);
                 d->rateLimiter.start();
                 return;
             }
         qCDebug(MAIN) << d->id() << "job queues are empty";
     });
+    d->retryTimer.callOnTimeout([this] { d->resumeRetries(steady_clock::now()); });
+    d->pacer.callOnTimeout([this] { d->releasePacedJobs(); });
+    if (QNetworkInformation::loadBackendByFeatures(QNetworkInformation::Feature::Reachability))
+        QObject::connect(QNetworkInformation::instance(),
+                         &QNetworkInformation::reachabilityChanged, &d->retryTimer,
+                         [this](QNetworkInformation::Reachability reachability) {
+                             if (reachability == QNetworkInformation::Reachability::Online)
+                                 networkRestored();
+                         });
 }
 
 ConnectionData::~ConnectionData()
 {
     d->rateLimiter.disconnect();
     d->rateLimiter.stop();
+    d->retryTimer.disconnect();
+    d->retryTimer.stop();
+    d->pacer.disconnect();
+    d->pacer.stop();
 }
 
 void ConnectionData::submit(BaseJob* job)
 {
     job->setStatus(BaseJob::Pending);
-    if (!d->rateLimiter.isActive()) {
-        QTimer::singleShot(0, job, &BaseJob::sendRequest);
-        return;
-    }
-    d->jobs[size_t(job->isBackground())].emplace(job);
-    qCDebug(MAIN) << job << "queued," << d->jobs.front().size() << "(fg) +"
-                  << d->jobs.back().size() << "(bg) total jobs in" << d->id()
-                  << "queues";
+    const auto mustWait = d->rateLimiter.interval() > 0 || !d->hasFreeSlot();
+    d->admit(job);
+    if (mustWait)
+        qCDebug(MAIN) << job << "queued," << d->jobs.front().size() << "(fg) +"
+                      << d->jobs.back().size() << "(bg) total jobs in" << d->id()
+                      << "queues";
 }
 
 void ConnectionData::limitRate(std::chrono::milliseconds nextCallAfter)
@@ -99,6 +324,62 @@ void ConnectionData::limitRate(std::chrono::milliseconds nextCallAfter)
     d->rateLimiter.start(nextCallAfter);
 }
 
+void ConnectionData::limitRate(const BaseJob* job, milliseconds nextCallAfter)
+{
+    const auto family = endpointFamily(job);
+    auto& limit = d->endpointLimits[family];
+    // The server advises when the next request will be allowed; assume that the same
+    // interval is needed between any two requests until proven otherwise
+    limit.interval = std::max(nextCallAfter, MinPacingInterval);
+    limit.burst = 1;
+    limit.tokens = 0;
+    limit.updated = steady_clock::now();
+    limit.successes = 0;
+    qCDebug(MAIN) << family << "requests in" << d->id() << "are rate-limited, pacing at one per"
+                  << limit.interval.count() << "ms";
+    d->startPacer();
+}
+
+milliseconds ConnectionData::scheduleRetry(BaseJob* job, int attempt)
+{
+    // Every attempt, as well as every request failed in a row, doubles the interval
+    const auto exponent =
+        std::clamp(std::max(attempt, d->failureStreak) - 1, 0, MaxBackoffExponent);
+    auto interval = std::min(FirstRetryInterval * (1 << exponent), MaxRetryInterval);
+    if (d->retryTokens >= 1)
+        d->retryTokens -= 1;
+    else {
+        qCDebug(MAIN) << d->id() << "has run out of the retry budget";
+        interval = MaxRetryInterval;
+    }
+    // Pick a random point in the second half of the interval, to spread retries out
+    const auto retryIn = interval / 2
+                         + milliseconds(QRandomGenerator::global()->bounded(
+                             qint64(interval.count() / 2) + 1));
+    d->retries.emplace(steady_clock::now() + retryIn, job);
+    if (!d->retryTimer.isActive() || d->retryTimer.remainingTimeAsDuration() > retryIn)
+        d->retryTimer.start(retryIn);
+    return retryIn;
+}
+
+void ConnectionData::networkRestored()
+{
+    d->failureStreak = 0;
+    if (d->retries.empty())
+        return;
+    qCInfo(MAIN) << "Network restored, resuming" << d->retries.size() << "job(s) in" << d->id();
+    d->resumeRetries(steady_clock::time_point::max());
+}
+
+void ConnectionData::setMaxConcurrentRequests(int maxRequests)
+{
+    d->maxConcurrentRequests = maxRequests;
+    if (!d->rateLimiter.isActive())
+        d->rateLimiter.start(0); // In case the limit has been raised
+}
+
+int ConnectionData::maxConcurrentRequests() const { return d->maxConcurrentRequests; }
+
 QByteArray ConnectionData::accessToken() const { return d->accessToken; }
 
 QUrl ConnectionData::baseUrl() const { return d->baseUrl; }
@@ -181,3 +462,30 @@ QString ConnectionData::generateTxnId() const
     return d->deviceId + QString::number(d->txnBase)
            + QString::number(++d->txnCounter);
 }
+
+bool ConnectionData::shareInFlightGet(const QUrl& url, BaseJob* job)
+{
+    const auto it = d->inFlightGets.constFind(url);
+    if (it == d->inFlightGets.cend())
+        return false;
+    if (!isJobPending(*it)) {
+        d->inFlightGets.erase(it);
+        return false;
+    }
+    ++d->coalescedRequests;
+    qCDebug(MAIN) << "Sharing" << *it << "instead of sending another request;"
+                  << d->coalescedRequests << "request(s) saved so far";
+    job->follow(*it, this);
+    return true;
+}
+
+void ConnectionData::addInFlightGet(const QUrl& url, BaseJob* sourceJob, BaseJob* job)
+{
+    // Jobs are not tracked to completion; drop the finished ones along the way instead
+    for (auto it = d->inFlightGets.begin(); it != d->inFlightGets.end();)
+        it = isJobPending(*it) ? std::next(it) : d->inFlightGets.erase(it);
+    d->inFlightGets.insert(url, sourceJob);
+    job->follow(sourceJob, this);
+}
+
+qsizetype ConnectionData::coalescedRequestsCount() const { return d->coalescedRequests; }
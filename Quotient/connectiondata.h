@@ -21,9 +21,49 @@ public:
     Q_DISABLE_COPY_MOVE(ConnectionData)
     virtual ~ConnectionData();
 
+    static constexpr int DefaultMaxConcurrentRequests = 16;
+
     void submit(BaseJob* job);
+
+    //! Suspend sending all requests on the connection for \p nextCallAfter
     void limitRate(std::chrono::milliseconds nextCallAfter);
 
+    //! \brief Pace requests of the endpoint family of \p job after it has been rate-limited
+    //!
+    //! Rate limits are tracked separately for each endpoint family (jobs of the same class),
+    //! so that, e.g., a flood of room messages doesn't delay syncing or media downloads.
+    //! The next request of the family is only sent after \p nextCallAfter; after that,
+    //! the requests are paced with a token bucket that starts at one request per
+    //! \p nextCallAfter and relaxes as long as the server accepts requests.
+    void limitRate(const BaseJob* job, std::chrono::milliseconds nextCallAfter);
+
+    //! \brief Schedule another attempt of a failed job
+    //!
+    //! Retries of all jobs on the connection are scheduled here, with exponential backoff
+    //! randomised so that jobs that failed together don't come back to the server together.
+    //! The backoff grows with both the number of attempts the job has taken and the number of
+    //! requests that failed in a row on the connection. Each retry also takes from the retry
+    //! budget that successful requests replenish; once it's depleted, retries are only taken
+    //! at the longest interval. The job is put back to the queue when its time comes, or
+    //! earlier if the network gets restored (see networkRestored()).
+    //! \return the time until the next attempt
+    std::chrono::milliseconds scheduleRetry(BaseJob* job, int attempt);
+
+    //! \brief Resume all jobs waiting for a retry
+    //!
+    //! This is called when a request reaches the server after a series of network failures,
+    //! as well as when the system reports the network as reachable again (on platforms that
+    //! support that); clients can call it too, e.g. when the user asks to reconnect. The jobs
+    //! go through the job queue, foreground ones first.
+    void networkRestored();
+
+    //! \brief Set the maximum number of requests to run at the same time
+    //!
+    //! Jobs submitted beyond this number wait in the queue, foreground jobs being sent first;
+    //! 0 means no limit. The default is DefaultMaxConcurrentRequests.
+    void setMaxConcurrentRequests(int maxRequests);
+    int maxConcurrentRequests() const;
+
     QByteArray accessToken() const;
     QUrl baseUrl() const;
     const QString& deviceId() const;
@@ -44,6 +84,26 @@ public:
 
     QString generateTxnId() const;
 
+    //! \brief Make \p job share the pending GET request to \p url, if there's one
+    //!
+    //! If a source job registered with addInFlightGet() for the same URL is still pending,
+    //! \p job doesn't send a request of its own but takes over the result of the source job
+    //! once it arrives (see BaseJob::adoptResult()). Each such job can be abandoned on its own;
+    //! the source job is only abandoned along with the last of them.
+    //! \return whether \p job shares a pending request; if not, \p job is left intact
+    bool shareInFlightGet(const QUrl& url, BaseJob* job);
+
+    //! \brief Register a job sending a GET request to \p url, to be shared
+    //!
+    //! \p sourceJob should be started already and not handed out to anyone; \p job is its first
+    //! follower, as with shareInFlightGet(). The request must be idempotent and the jobs should
+    //! not depend on the caller in any way other than the URL (e.g. should not write to a file
+    //! the caller specified).
+    void addInFlightGet(const QUrl& url, BaseJob* sourceJob, BaseJob* job);
+
+    //! The number of GET requests that were not sent because an identical one was in flight
+    qsizetype coalescedRequestsCount() const;
+
 private:
     class Private;
     ImplPtr<Private> d;
@@ -14,6 +14,8 @@
 #include <qt6keychain/keychain.h>
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtConcurrent/QtConcurrentMap>
 
 using namespace Quotient;
 using namespace Quotient::_impl;
@@ -908,35 +910,40 @@ void ConnectionEncryptionData::doSendSessionKeyToDevices(
 
     const auto sendKey = [devices, this, sessionId, messageIndex, sessionKey,
                           roomId] {
-        QHash<QString, QHash<QString, QJsonObject>> usersToDevicesToContent;
+        // The payload is the same for all devices, save for the recipient part
+        const auto keyEventJson = RoomKeyEvent(MegolmV1AesSha2AlgoKey, roomId,
+                                               QString::fromLatin1(sessionId),
+                                               QString::fromLatin1(sessionKey))
+                                      .fullJson();
+        QVector<std::tuple<QString, QString, QString>> devicesWithoutSession;
+        std::vector<RoomKeyTarget> targets;
+        targets.reserve(size_t(devices.size()));
         for (const auto& [targetUserId, targetDeviceId] : devices.asKeyValueRange()) {
-            if (!hasOlmSession(targetUserId, targetDeviceId))
+            const auto curveKey = curveKeyForUserDevice(targetUserId, targetDeviceId);
+            if (!hasOlmSession(targetUserId, targetDeviceId)) {
+                devicesWithoutSession.push_back({ targetUserId, targetDeviceId, curveKey });
                 continue;
-
-            // Noisy and leaks the key to logs but nice for debugging
-//            qDebug(E2EE) << "Creating the payload for" << targetUserId
-//                         << targetDeviceId << sessionId << sessionKey.toHex();
-            const auto keyEventJson =
-                RoomKeyEvent(MegolmV1AesSha2AlgoKey, roomId,
-                             QString::fromLatin1(sessionId),
-                             QString::fromLatin1(sessionKey))
-                    .fullJson();
-
-            usersToDevicesToContent[targetUserId][targetDeviceId] =
-                assembleEncryptedContent(keyEventJson, targetUserId,
-                                         targetDeviceId);
+            }
+            targets.push_back({ targetUserId, targetDeviceId, curveKey,
+                                q->edKeyForUserDevice(targetUserId, targetDeviceId) });
         }
-        if (!usersToDevicesToContent.empty()) {
-            q->sendToDevices(EncryptedEvent::TypeId, usersToDevicesToContent);
-            QVector<std::tuple<QString, QString, QString>> receivedDevices;
-            receivedDevices.reserve(devices.size());
-            for (const auto& [user, device] : devices.asKeyValueRange())
-                receivedDevices.push_back(
-                    { user, device, curveKeyForUserDevice(user, device) });
-
-            database.setDevicesReceivedKey(roomId, receivedDevices,
-                                           sessionId, messageIndex);
+        // As before, devices that we couldn't get an olm session with are not tried again
+        // for this megolm session
+        if (!devicesWithoutSession.isEmpty()) {
+            database.setDevicesReceivedKey(roomId, devicesWithoutSession, sessionId,
+                                           messageIndex);
+            if (auto* room = q->room(roomId)) {
+                QMultiHash<QString, QString> recorded;
+                for (const auto& [user, device, curveKey] : devicesWithoutSession)
+                    recorded.insert(user, device);
+                room->onDevicesReceivedKey(sessionId, recorded);
+            }
         }
+        if (targets.empty())
+            return;
+
+        encryptRoomKeys(keyEventJson, targets);
+        sendRoomKeys(roomId, sessionId, messageIndex, targets);
     };
 
     if (hash.isEmpty()) {
@@ -944,13 +951,123 @@ void ConnectionEncryptionData::doSendSessionKeyToDevices(
         return;
     }
 
-    q->callApi<ClaimKeysJob>(hash).then(q, [this, sendKey](const ClaimKeysJob* job) {
-        for (const auto& [userId, userDevices] : job->oneTimeKeys().asKeyValueRange())
-            for (const auto& [deviceId, keys] : userDevices.asKeyValueRange())
-                createOlmSession(userId, deviceId, keys);
+    q->callApi<ClaimKeysJob>(hash).then(
+        q,
+        [this, sendKey](const ClaimKeysJob* job) {
+            for (const auto& [userId, userDevices] : job->oneTimeKeys().asKeyValueRange())
+                for (const auto& [deviceId, keys] : userDevices.asKeyValueRange())
+                    createOlmSession(userId, deviceId, keys);
 
-        sendKey();
-    });
+            sendKey();
+        },
+        [this, roomId, sessionId, devices] {
+            qCWarning(E2EE) << "Failed to claim one-time keys to send room key" << sessionId;
+            if (auto* room = q->room(roomId))
+                room->onDevicesFailedKey(sessionId, devices);
+        });
+}
+
+void ConnectionEncryptionData::encryptRoomKeys(const QJsonObject& keyEventJson,
+                                               std::vector<RoomKeyTarget>& targets)
+{
+    QElapsedTimer et;
+    et.start();
+    // An olm session can only be used by one thread at a time; so targets are grouped by
+    // session and each group is encrypted in one go
+    std::vector<std::pair<const QOlmSession*, std::vector<RoomKeyTarget*>>> targetsBySession;
+    std::unordered_map<const QOlmSession*, size_t> sessionPositions;
+    for (auto& target : targets) {
+        const auto* olmSession = &olmSessions.at(target.curveKey.toLatin1()).front();
+        const auto [it, isNew] = sessionPositions.try_emplace(olmSession, targetsBySession.size());
+        if (isNew)
+            targetsBySession.emplace_back(olmSession, std::vector<RoomKeyTarget*>{});
+        targetsBySession[it->second].second.push_back(&target);
+    }
+    QJsonObject payloadTemplate = keyEventJson;
+    payloadTemplate.insert(SenderKey, q->userId());
+    payloadTemplate.insert("keys"_ls,
+                           QJsonObject{ { Ed25519Key, olmAccount.identityKeys().ed25519 } });
+    const auto encryptSessionTargets = [&payloadTemplate](const auto& sessionTargets) {
+        const auto& [olmSession, sessionTargetPtrs] = sessionTargets;
+        for (auto* target : sessionTargetPtrs) {
+            auto payloadJson = payloadTemplate;
+            payloadJson.insert("recipient"_ls, target->userId);
+            payloadJson.insert("recipient_keys"_ls, QJsonObject{ { Ed25519Key, target->edKey } });
+            const auto message =
+                olmSession->encrypt(QJsonDocument(payloadJson).toJson(QJsonDocument::Compact));
+            target->messageType = message.type();
+            target->ciphertext = message.toCiphertext();
+        }
+    };
+    // Olm encryption is fast enough to not bother with threads for a few devices
+    static constexpr size_t MinTargetsToParallelise = 16;
+    if (targetsBySession.size() > 1 && targets.size() >= MinTargetsToParallelise)
+        QtConcurrent::blockingMap(targetsBySession, encryptSessionTargets);
+    else
+        std::ranges::for_each(targetsBySession, encryptSessionTargets);
+    // The database is only used from this thread
+    for (const auto& [olmSession, sessionTargetPtrs] : targetsBySession)
+        database.updateOlmSession(sessionTargetPtrs.front()->curveKey.toLatin1(), *olmSession);
+    qCDebug(PROFILER) << "Encrypted the room key for" << targets.size() << "device(s) in"
+                      << targetsBySession.size() << "olm session(s) in" << et;
+}
+
+void ConnectionEncryptionData::sendRoomKeys(const QString& roomId, const QByteArray& sessionId,
+                                            uint32_t messageIndex,
+                                            const std::vector<RoomKeyTarget>& targets)
+{
+    // Homeservers limit the request size, and one huge request is all-or-nothing anyway
+    static constexpr size_t MaxDevicesPerRequest = 100;
+    const auto chunksCount = (targets.size() + MaxDevicesPerRequest - 1) / MaxDevicesPerRequest;
+    const auto ourCurveKey = olmAccount.identityKeys().curve25519;
+    for (size_t chunkStart = 0, chunk = 1; chunkStart < targets.size();
+         chunkStart += MaxDevicesPerRequest, ++chunk) {
+        const auto chunkEnd = std::min(chunkStart + MaxDevicesPerRequest, targets.size());
+        QHash<QString, QHash<QString, QJsonObject>> usersToDevicesToContent;
+        QVector<std::tuple<QString, QString, QString>> chunkDevices;
+        chunkDevices.reserve(qsizetype(chunkEnd - chunkStart));
+        for (auto i = chunkStart; i < chunkEnd; ++i) {
+            const auto& target = targets[i];
+            const QJsonObject encrypted{
+                { target.curveKey,
+                  QJsonObject{ { "type"_ls, target.messageType },
+                               { "body"_ls, QString::fromLatin1(target.ciphertext) } } }
+            };
+            usersToDevicesToContent[target.userId][target.deviceId] =
+                EncryptedEvent(encrypted, ourCurveKey).contentJson();
+            chunkDevices.push_back({ target.userId, target.deviceId, target.curveKey });
+        }
+        // All chunks are sent without waiting for each other; each chunk is recorded as
+        // delivered on its own, so a failed chunk gets sent again along with the next message
+        auto* job = q->sendToDevices(EncryptedEvent::TypeId, usersToDevicesToContent);
+        QObject::connect(job, &BaseJob::success, q,
+                         [this, roomId, sessionId, messageIndex, chunkDevices, chunk,
+                          chunksCount] {
+                             qCDebug(E2EE) << "Room key" << sessionId << "delivered to"
+                                           << chunkDevices.size() << "device(s), chunk"
+                                           << chunk << "of" << chunksCount;
+                             database.setDevicesReceivedKey(roomId, chunkDevices, sessionId,
+                                                            messageIndex);
+                             if (auto* room = q->room(roomId)) {
+                                 QMultiHash<QString, QString> delivered;
+                                 for (const auto& [user, device, curveKey] : chunkDevices)
+                                     delivered.insert(user, device);
+                                 room->onDevicesReceivedKey(sessionId, delivered);
+                             }
+                         });
+        QObject::connect(job, &BaseJob::failure, q,
+                         [this, roomId, sessionId, chunkDevices, chunk, chunksCount](BaseJob* j) {
+                             qCWarning(E2EE) << "Failed to send room key" << sessionId
+                                             << "- chunk" << chunk << "of" << chunksCount
+                                             << "failed:" << j->errorString();
+                             if (auto* room = q->room(roomId)) {
+                                 QMultiHash<QString, QString> failed;
+                                 for (const auto& [user, device, curveKey] : chunkDevices)
+                                     failed.insert(user, device);
+                                 room->onDevicesFailedKey(sessionId, failed);
+                             }
+                         });
+    }
 }
 
 void ConnectionEncryptionData::sendSessionKeyToDevices(
@@ -122,6 +122,21 @@ namespace _impl {
         void doSendSessionKeyToDevices(const QString& roomId, const QByteArray& sessionId,
             const QByteArray &sessionKey, uint32_t messageIndex,
             const QMultiHash<QString, QString>& devices);
+
+        //! A device to send a room key to, along with the key encrypted for it
+        struct RoomKeyTarget {
+            QString userId;
+            QString deviceId;
+            QString curveKey;
+            QString edKey;
+            QOlmMessage::Type messageType = QOlmMessage::General;
+            QByteArray ciphertext{};
+        };
+        //! Encrypt the room key for all \p targets, using worker threads for many targets
+        void encryptRoomKeys(const QJsonObject& keyEventJson, std::vector<RoomKeyTarget>& targets);
+        //! Send the encrypted room keys, in requests of bounded size
+        void sendRoomKeys(const QString& roomId, const QByteArray& sessionId,
+                          uint32_t messageIndex, const std::vector<RoomKeyTarget>& targets);
     };
 } // namespace _impl
 } // namespace Quotient
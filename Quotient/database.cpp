@@ -51,6 +51,11 @@ Database::Database(const QString& userId, const QString& deviceId,
     }
 }
 
+Database::~Database()
+{
+    flushGroupSessionIndexRecords();
+}
+
 int Database::version()
 {
     auto query = execute(QStringLiteral("PRAGMA user_version;"));
@@ -299,6 +304,9 @@ std::optional<OlmErrorCode> Database::setupOlmAccount(QOlmAccount& olmAccount)
 
 void Database::clear()
 {
+    m_groupSessionIndices.clear();
+    m_indexedGroupSessions.clear();
+    m_pendingGroupSessionIndexRecords.clear();
     // SQLite driver only supports one query at a time, so feed them one by one
     transaction();
     for (auto&& q : { QStringLiteral("DELETE FROM accounts;"), // @clang-format: one per line, plz
@@ -348,6 +356,22 @@ std::unordered_map<QByteArray, std::vector<QOlmSession> > Database::loadOlmSessi
     return sessions;
 }
 
+namespace {
+std::optional<QOlmInboundGroupSession> unpickleMegolmSession(const QSqlQuery& query,
+                                                             const PicklingKey& picklingKey)
+{
+    auto&& expectedSession =
+        QOlmInboundGroupSession::unpickle(query.value("pickle"_ls).toByteArray(), picklingKey);
+    if (!expectedSession) {
+        qCWarning(E2EE) << "Failed to unpickle megolm session:" << expectedSession.error();
+        return {};
+    }
+    expectedSession->setOlmSessionId(query.value("olmSessionId"_ls).toByteArray());
+    expectedSession->setSenderId(query.value("senderId"_ls).toString());
+    return std::move(*expectedSession);
+}
+} // namespace
+
 std::unordered_map<QByteArray, QOlmInboundGroupSession> Database::loadMegolmSessions(
     const QString& roomId)
 {
@@ -358,8 +382,7 @@ std::unordered_map<QByteArray, QOlmInboundGroupSession> Database::loadMegolmSess
     commit();
     decltype(Database::loadMegolmSessions({})) sessions;
     while (query.next()) {
-        if (auto&& expectedSession = QOlmInboundGroupSession::unpickle(
-                query.value("pickle"_ls).toByteArray(), m_picklingKey)) {
+        if (auto&& session = unpickleMegolmSession(query, m_picklingKey)) {
             const auto sessionId = query.value("sessionId"_ls).toByteArray();
             if (const auto it = sessions.find(sessionId); it != sessions.end()) {
                 qCritical(DATABASE) << "More than one inbound group session "
@@ -372,18 +395,29 @@ std::unordered_map<QByteArray, QOlmInboundGroupSession> Database::loadMegolmSess
                        "used so some messages will be undecryptable";
                 sessions.erase(it);
             }
-            expectedSession->setOlmSessionId(
-                query.value("olmSessionId"_ls).toByteArray());
-            expectedSession->setSenderId(query.value("senderId"_ls).toString());
-            sessions.try_emplace(query.value("sessionId"_ls).toByteArray(),
-                                 std::move(*expectedSession));
-        } else
-            qCWarning(E2EE) << "Failed to unpickle megolm session:"
-                            << expectedSession.error();
+            sessions.try_emplace(sessionId, std::move(*session));
+        }
     }
     return sessions;
 }
 
+std::optional<QOlmInboundGroupSession> Database::loadMegolmSession(const QString& roomId,
+                                                                   const QByteArray& sessionId)
+{
+    auto query = prepareQuery(QStringLiteral("SELECT * FROM inbound_megolm_sessions WHERE roomId=:roomId AND sessionId=:sessionId;"));
+    query.bindValue(":roomId"_ls, roomId);
+    query.bindValue(":sessionId"_ls, sessionId);
+    transaction();
+    execute(query);
+    commit();
+    // As in loadMegolmSessions(), the last session wins if there are several
+    std::optional<QOlmInboundGroupSession> result;
+    while (query.next())
+        if (auto&& session = unpickleMegolmSession(query, m_picklingKey))
+            result = std::move(session);
+    return result;
+}
+
 void Database::saveMegolmSession(const QString& roomId,
                                  const QOlmInboundGroupSession& session, const QByteArray &senderKey, const QByteArray& senderClaimedEdKey)
 {
@@ -407,30 +441,60 @@ void Database::saveMegolmSession(const QString& roomId,
 
 void Database::addGroupSessionIndexRecord(const QString& roomId, const QString& sessionId, uint32_t index, const QString& eventId, qint64 ts)
 {
+    GroupSessionKey session{ roomId, sessionId };
+    groupSessionIndex(session).insert(index, { eventId, ts });
+    m_pendingGroupSessionIndexRecords.push_back({ std::move(session), index, eventId, ts });
+}
+
+std::pair<QString, qint64> Database::groupSessionIndexRecord(const QString& roomId, const QString& sessionId, qint64 index)
+{
+    return groupSessionIndex({ roomId, sessionId }).value(index);
+}
+
+void Database::flushGroupSessionIndexRecords()
+{
+    if (m_pendingGroupSessionIndexRecords.isEmpty())
+        return;
     auto query = prepareQuery("INSERT INTO group_session_record_index(roomId, sessionId, i, eventId, ts) VALUES(:roomId, :sessionId, :index, :eventId, :ts);"_ls);
-    query.bindValue(":roomId"_ls, roomId);
-    query.bindValue(":sessionId"_ls, sessionId);
-    query.bindValue(":index"_ls, index);
-    query.bindValue(":eventId"_ls, eventId);
-    query.bindValue(":ts"_ls, ts);
     transaction();
-    execute(query);
+    for (const auto& [session, index, eventId, ts] : std::as_const(m_pendingGroupSessionIndexRecords)) {
+        query.bindValue(":roomId"_ls, session.first);
+        query.bindValue(":sessionId"_ls, session.second);
+        query.bindValue(":index"_ls, index);
+        query.bindValue(":eventId"_ls, eventId);
+        query.bindValue(":ts"_ls, ts);
+        execute(query);
+    }
     commit();
+    m_pendingGroupSessionIndexRecords.clear();
 }
 
-std::pair<QString, qint64> Database::groupSessionIndexRecord(const QString& roomId, const QString& sessionId, qint64 index)
+Database::GroupSessionIndex& Database::groupSessionIndex(const GroupSessionKey& session)
 {
-    auto query = prepareQuery(QStringLiteral("SELECT * FROM group_session_record_index WHERE roomId=:roomId AND sessionId=:sessionId AND i=:index;"));
-    query.bindValue(":roomId"_ls, roomId);
-    query.bindValue(":sessionId"_ls, sessionId);
-    query.bindValue(":index"_ls, index);
+    if (auto it = m_groupSessionIndices.find(session); it != m_groupSessionIndices.end())
+        return *it;
+
+    // Each record takes about a hundred bytes; keeping a few hundred sessions around covers
+    // the active ones without letting the memory footprint grow with the account history
+    static constexpr size_t MaxIndexedSessions = 256;
+    if (m_indexedGroupSessions.size() >= MaxIndexedSessions) {
+        flushGroupSessionIndexRecords(); // Pending records may belong to the evicted session
+        m_groupSessionIndices.remove(m_indexedGroupSessions.front());
+        m_indexedGroupSessions.pop_front();
+    }
+
+    auto query = prepareQuery(QStringLiteral("SELECT i, eventId, ts FROM group_session_record_index WHERE roomId=:roomId AND sessionId=:sessionId;"));
+    query.bindValue(":roomId"_ls, session.first);
+    query.bindValue(":sessionId"_ls, session.second);
     transaction();
     execute(query);
     commit();
-    if (!query.next()) {
-        return {};
-    }
-    return {query.value("eventId"_ls).toString(), query.value("ts"_ls).toLongLong()};
+    GroupSessionIndex index;
+    while (query.next())
+        index.insert(query.value("i"_ls).toLongLong(),
+                     { query.value("eventId"_ls).toString(), query.value("ts"_ls).toLongLong() });
+    m_indexedGroupSessions.push_back(session);
+    return *m_groupSessionIndices.insert(session, std::move(index));
 }
 
 QSqlDatabase Database::database() const
@@ -447,6 +511,13 @@ QSqlQuery Database::prepareQuery(const QString& queryString) const
 
 void Database::clearRoomData(const QString& roomId)
 {
+    const auto isInRoom = [&roomId](const GroupSessionKey& session) {
+        return session.first == roomId;
+    };
+    m_groupSessionIndices.removeIf([&isInRoom](const auto& it) { return isInRoom(it.key()); });
+    std::erase_if(m_indexedGroupSessions, isInRoom);
+    m_pendingGroupSessionIndexRecords.removeIf(
+        [&isInRoom](const GroupSessionIndexRecord& r) { return isInRoom(r.session); });
     transaction();
     for (const auto& queryText :
          { QStringLiteral(
@@ -495,6 +566,16 @@ void Database::saveCurrentOutboundMegolmSession(const QString& roomId,
     commit();
 }
 
+void Database::removeOutboundMegolmSessions(const QString& roomId)
+{
+    auto query = prepareQuery(
+        QStringLiteral("DELETE FROM outbound_megolm_sessions WHERE roomId=:roomId;"));
+    query.bindValue(":roomId"_ls, roomId);
+    transaction();
+    execute(query);
+    commit();
+}
+
 std::optional<QOlmOutboundGroupSession> Database::loadCurrentOutboundMegolmSession(
     const QString& roomId)
 {
@@ -550,6 +631,22 @@ QMultiHash<QString, QString> Database::devicesWithoutKey(
     return devices;
 }
 
+QHash<QString, QSet<QString>> Database::devicesWithKey(const QString& roomId,
+                                                      const QByteArray& sessionId)
+{
+    auto query = prepareQuery(QStringLiteral("SELECT userId, deviceId FROM sent_megolm_sessions WHERE roomId=:roomId AND sessionId=:sessionId"));
+    query.bindValue(":roomId"_ls, roomId);
+    query.bindValue(":sessionId"_ls, sessionId);
+    transaction();
+    execute(query);
+    commit();
+    QHash<QString, QSet<QString>> devices;
+    while (query.next())
+        devices[query.value("userId"_ls).toString()].insert(
+            query.value("deviceId"_ls).toString());
+    return devices;
+}
+
 void Database::updateOlmSession(const QByteArray& senderKey,
                                 const QOlmSession& session)
 {
@@ -8,6 +8,9 @@
 #include <QtCore/QVector>
 
 #include <QtCore/QHash>
+#include <QtCore/QSet>
+
+#include <deque>
 
 #include "e2ee/e2ee_common.h"
 
@@ -23,6 +26,7 @@ class QUOTIENT_API Database
 public:
     Database(const QString& userId, const QString& deviceId,
              PicklingKey&& picklingKey);
+    ~Database();
 
     int version();
     void transaction();
@@ -40,22 +44,42 @@ public:
     std::unordered_map<QByteArray, std::vector<QOlmSession>> loadOlmSessions();
     std::unordered_map<QByteArray, QOlmInboundGroupSession> loadMegolmSessions(
         const QString& roomId);
+    //! Load one inbound megolm session of the room, if it's in the database
+    std::optional<QOlmInboundGroupSession> loadMegolmSession(const QString& roomId,
+                                                             const QByteArray& sessionId);
     void saveMegolmSession(const QString& roomId,
                            const QOlmInboundGroupSession& session,
                            const QByteArray& senderKey,
                            const QByteArray& senderClaimedEdKey);
+    //! \brief Record that the message with \p index in a megolm session came in \p eventId
+    //!
+    //! The record is available to groupSessionIndexRecord() right away but is only written
+    //! to the database by the next flushGroupSessionIndexRecords() call.
     void addGroupSessionIndexRecord(const QString& roomId,
                                     const QString& sessionId, uint32_t index,
                                     const QString& eventId, qint64 ts);
+    //! \brief Get the event id and timestamp recorded for \p index in a megolm session
+    //!
+    //! Records of recently used sessions are kept in memory; the first lookup in a session
+    //! loads all its records from the database at once.
     std::pair<QString, qint64> groupSessionIndexRecord(const QString& roomId,
                                                        const QString& sessionId,
                                                        qint64 index);
+    //! Write all records added since the last flush to the database, in one transaction
+    void flushGroupSessionIndexRecords();
     void clearRoomData(const QString& roomId);
     void setOlmSessionLastReceived(const QByteArray& sessionId,
                                    const QDateTime& timestamp);
     std::optional<QOlmOutboundGroupSession> loadCurrentOutboundMegolmSession(const QString& roomId);
     void saveCurrentOutboundMegolmSession(
         const QString& roomId, const QOlmOutboundGroupSession& session);
+    //! \brief Remove the stored outbound megolm sessions of the room
+    //!
+    //! Call this before the current session moves ahead of its stored state, unless that state
+    //! is saved again right after. If the application stops before the next save,
+    //! loadCurrentOutboundMegolmSession() then finds nothing and a new session gets created,
+    //! instead of the stale one reusing message indices.
+    void removeOutboundMegolmSessions(const QString& roomId);
     void updateOlmSession(const QByteArray& senderKey,
                           const QOlmSession& session);
 
@@ -63,6 +87,9 @@ public:
     QMultiHash<QString, QString> devicesWithoutKey(
         const QString& roomId, QMultiHash<QString, QString> devices,
         const QByteArray& sessionId);
+    //! Get the devices that have received the outbound megolm session, by user id
+    QHash<QString, QSet<QString>> devicesWithKey(const QString& roomId,
+                                                 const QByteArray& sessionId);
     // 'devices' contains tuples {userId, deviceId, curveKey}
     void setDevicesReceivedKey(
         const QString& roomId,
@@ -95,8 +122,25 @@ private:
     void migrateTo9();
     void migrateTo10();
 
+    //! Message index -> (event id, timestamp)
+    using GroupSessionIndex = QHash<qint64, std::pair<QString, qint64>>;
+    //! (room id, session id)
+    using GroupSessionKey = std::pair<QString, QString>;
+    struct GroupSessionIndexRecord {
+        GroupSessionKey session;
+        uint32_t index;
+        QString eventId;
+        qint64 ts;
+    };
+
+    GroupSessionIndex& groupSessionIndex(const GroupSessionKey& session);
+
     QString m_userId;
     QString m_deviceId;
     PicklingKey m_picklingKey;
+    QHash<GroupSessionKey, GroupSessionIndex> m_groupSessionIndices;
+    //! Sessions in m_groupSessionIndices, in the order of loading
+    std::deque<GroupSessionKey> m_indexedGroupSessions;
+    QVector<GroupSessionIndexRecord> m_pendingGroupSessionIndexRecords;
 };
 } // namespace Quotient
@@ -18,6 +18,7 @@
 #include <olm/pk.h>
 #include <olm/olm.h>
 
+#include <algorithm>
 #include <source_location>
 
 using namespace Quotient;
@@ -142,6 +143,49 @@ SslExpected<QByteArray> Quotient::aesCtr256Encrypt(const QByteArray& plaintext,
     return encrypted;
 }
 
+SslExpected<QByteArray> Quotient::aesCtr256Transform(const QByteArray& data,
+                                                     byte_view_t<Aes256KeySize> key,
+                                                     byte_view_t<AesBlockSize> iv, qint64 offset)
+{
+    Q_ASSERT(offset >= 0);
+    CLAMP_SIZE(dataSize, data);
+    if (dataSize == 0)
+        return QByteArray();
+
+    // OpenSSL treats the whole IV as a big-endian 128-bit counter; advance it to the block
+    // where the fragment starts
+    std::array<byte_t, AesBlockSize> counter{};
+    std::ranges::copy(iv, counter.begin());
+    auto carry = static_cast<quint64>(offset) / AesBlockSize;
+    for (auto it = counter.rbegin(); carry != 0 && it != counter.rend(); ++it) {
+        carry += *it;
+        *it = static_cast<byte_t>(carry & 0xFF);
+        carry >>= 8;
+    }
+
+    const ContextHolder ctx(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+    if (ALARM_X(!ctx, QByteArrayLiteral("failed to create SSL context: ")
+                          + ERR_error_string(ERR_get_error(), nullptr)))
+        return ERR_get_error();
+    CALL_OPENSSL(EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_ctr(), nullptr, key.data(),
+                                    counter.data()));
+
+    int length = 0;
+    if (const auto skip = static_cast<int>(offset % AesBlockSize); skip > 0) {
+        // Consume the part of the key stream before the fragment
+        constexpr auto blockOfZeros = zeroes<AesBlockSize>();
+        std::array<byte_t, AesBlockSize> discarded{};
+        CALL_OPENSSL(EVP_EncryptUpdate(ctx.get(), discarded.data(), &length,
+                                       blockOfZeros.data(), skip));
+    }
+    QByteArray result(dataSize, Qt::Uninitialized);
+    CALL_OPENSSL(EVP_EncryptUpdate(ctx.get(), asWritableCBytes(result).data(), &length,
+                                   asCBytes(data).data(), dataSize));
+    // AES-CTR has no padding, so there's nothing to finalise
+    result.resize(length);
+    return result;
+}
+
 SslExpected<HkdfKeys> Quotient::hkdfSha256(byte_view_t<DefaultPbkdf2KeyLength> key,
                                            byte_view_t<32> salt, byte_view_t<> info)
 {
@@ -114,6 +114,20 @@ QUOTIENT_API SslExpected<QByteArray> aesCtr256Decrypt(
     const QByteArray& ciphertext, byte_view_t<Aes256KeySize> key,
     byte_view_t<AesBlockSize> iv);
 
+//! \brief Encrypt or decrypt a fragment of an AES-CTR-256 stream
+//!
+//! In CTR mode encryption and decryption are the same operation, and any fragment of the stream
+//! can be processed on its own once its position is known. This allows to encrypt or decrypt
+//! large files chunk by chunk, without keeping them in memory entirely.
+//! \param data the fragment to process
+//! \param key the key for the whole stream
+//! \param iv the initial counter block for the whole stream
+//! \param offset the position of \p data in the stream
+QUOTIENT_API SslExpected<QByteArray> aesCtr256Transform(const QByteArray& data,
+                                                        byte_view_t<Aes256KeySize> key,
+                                                        byte_view_t<AesBlockSize> iv,
+                                                        qint64 offset);
+
 QUOTIENT_API std::vector<byte_t> base58Decode(const QByteArray& encoded);
 
 QUOTIENT_API QByteArray sign(const QByteArray &key, const QByteArray &data);
@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "filecrypto.h"
+
+#include "cryptoutils.h"
+#include "e2ee_common.h"
+
+#include "../logging_categories_p.h"
+
+#include <QtCore/QCryptographicHash>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Quotient;
+
+namespace {
+//! The largest chunk encrypted at once, whatever the reader asks for
+constexpr qint64 MaxChunkSize = 1 << 20;
+}
+
+class Q_DECL_HIDDEN EncryptingDevice::Private {
+public:
+    QIODevice* source;
+    FixedBuffer<Aes256KeySize> key = getRandom<Aes256KeySize>();
+    FixedBuffer<AesBlockSize> iv = getRandom<AesBlockSize>();
+    QCryptographicHash hash{ QCryptographicHash::Sha256 };
+    //! The length of the ciphertext prefix that has been hashed so far
+    qint64 hashedSize = 0;
+
+    //! \brief Read up to \p maxSize bytes of the source at \p offset and encrypt them
+    //!
+    //! The part of the chunk that extends the hashed ciphertext prefix is added to the hash;
+    //! chunks starting beyond the prefix (after a seek forward) are left for metadata() to
+    //! process again.
+    std::optional<QByteArray> encryptChunk(qint64 offset, qint64 maxSize)
+    {
+        if (source->pos() != offset && !source->seek(offset))
+            return std::nullopt;
+        auto plaintext = source->read(std::min(maxSize, MaxChunkSize));
+        if (plaintext.isEmpty())
+            return plaintext;
+        auto ciphertext = aesCtr256Transform(plaintext, key, iv, offset);
+        if (!ciphertext.has_value())
+            return std::nullopt;
+        const auto end = offset + ciphertext->size();
+        if (offset <= hashedSize && hashedSize < end) {
+            hash.addData(QByteArrayView(*ciphertext).sliced(hashedSize - offset));
+            hashedSize = end;
+        }
+        return ciphertext.move_value_or({});
+    }
+};
+
+EncryptingDevice::EncryptingDevice(QIODevice* source, QObject* parent)
+    : QIODevice(parent), d(makeImpl<Private>(source))
+{
+    Q_ASSERT(source != nullptr && !source->isSequential());
+    source->setParent(this);
+}
+
+bool EncryptingDevice::open(OpenMode mode)
+{
+    if (mode.testFlag(WriteOnly)) {
+        setErrorString(tr("EncryptingDevice can only be read from"));
+        return false;
+    }
+    if (!d->source->isOpen() && !d->source->open(ReadOnly)) {
+        setErrorString(d->source->errorString());
+        return false;
+    }
+    // Encrypted chunks are produced on demand, buffering them once more is pointless
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void EncryptingDevice::close()
+{
+    d->source->close();
+    QIODevice::close();
+}
+
+bool EncryptingDevice::isSequential() const { return false; }
+
+qint64 EncryptingDevice::size() const { return d->source->size(); }
+
+std::optional<EncryptedFileMetadata> EncryptingDevice::metadata()
+{
+    Q_ASSERT(isOpen());
+    while (d->hashedSize < size()) {
+        const auto chunk = d->encryptChunk(d->hashedSize, MaxChunkSize);
+        if (!chunk || chunk->isEmpty()) {
+            qCWarning(E2EE) << "Couldn't encrypt the file to calculate its hash";
+            return std::nullopt;
+        }
+    }
+    const JWK key{ "oct"_ls,
+                   { "encrypt"_ls, "decrypt"_ls },
+                   "A256CTR"_ls,
+                   QString::fromLatin1(d->key.toBase64(QByteArray::Base64UrlEncoding
+                                                       | QByteArray::OmitTrailingEquals)),
+                   true };
+    const auto hash = d->hash.result().toBase64(QByteArray::OmitTrailingEquals);
+    return EncryptedFileMetadata{ {},
+                                  key,
+                                  QString::fromLatin1(
+                                      d->iv.toBase64(QByteArray::OmitTrailingEquals)),
+                                  { { "sha256"_ls, QString::fromLatin1(hash) } },
+                                  "v2"_ls };
+}
+
+qint64 EncryptingDevice::readData(char* data, qint64 maxSize)
+{
+    const auto ciphertext = d->encryptChunk(pos(), maxSize);
+    if (!ciphertext) {
+        setErrorString(tr("Couldn't read or encrypt the file: %1").arg(d->source->errorString()));
+        return -1;
+    }
+    std::memcpy(data, ciphertext->constData(), static_cast<size_t>(ciphertext->size()));
+    return ciphertext->size();
+}
+
+qint64 EncryptingDevice::writeData(const char*, qint64) { return -1; }
+
+class Q_DECL_HIDDEN FileDecryptor::Private {
+public:
+    QByteArray key;
+    QByteArray iv;
+    QByteArray expectedHash;
+    QCryptographicHash hash{ QCryptographicHash::Sha256 };
+    //! The number of ciphertext bytes decrypted so far
+    qint64 offset = 0;
+};
+
+FileDecryptor::FileDecryptor(const EncryptedFileMetadata& metadata)
+    : d(makeImpl<Private>(
+        QByteArray::fromBase64(metadata.key.k.toLatin1(), QByteArray::Base64UrlEncoding),
+        QByteArray::fromBase64(metadata.iv.toLatin1()),
+        QByteArray::fromBase64(metadata.hashes.value("sha256"_ls).toLatin1())))
+{}
+
+bool FileDecryptor::isValid() const
+{
+    if (d->key.size() < Aes256KeySize) {
+        qCWarning(E2EE) << "Decoded key is too short for AES, need" << Aes256KeySize
+                        << "bytes, got" << d->key.size();
+        return false;
+    }
+    if (d->iv.size() < AesBlockSize) {
+        qCWarning(E2EE) << "Decoded iv is too short for AES, need" << AesBlockSize
+                        << "bytes, got" << d->iv.size();
+        return false;
+    }
+    return true;
+}
+
+SslExpected<QByteArray> FileDecryptor::decrypt(const QByteArray& ciphertext)
+{
+    Q_ASSERT(isValid());
+    auto result = aesCtr256Transform(ciphertext, asCBytes<Aes256KeySize>(d->key),
+                                     asCBytes<AesBlockSize>(d->iv), d->offset);
+    if (result.has_value()) {
+        d->hash.addData(ciphertext);
+        d->offset += ciphertext.size();
+    }
+    return result;
+}
+
+bool FileDecryptor::hashMatches() const
+{
+    if (d->expectedHash == d->hash.result())
+        return true;
+    qCWarning(E2EE) << "Hash verification failed for file";
+    return false;
+}
@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include "cryptoutils.h"
+
+#include "../events/filesourceinfo.h"
+#include "../util.h"
+
+#include <QtCore/QIODevice>
+
+#include <optional>
+
+namespace Quotient {
+
+//! \brief A read-only device that encrypts the contents of another device
+//!
+//! This is the streaming counterpart of encryptFile(): the plaintext is read from the source
+//! device and encrypted with AES-CTR-256 under a freshly generated key chunk by chunk, as
+//! the device is read; the SHA-256 hash of the ciphertext is calculated along the way. Memory
+//! consumption therefore doesn't depend on the source size, which makes the device suitable for
+//! uploading large files to encrypted rooms (pass it to Connection::uploadContent()).
+//!
+//! The device is random-access and has the same size as the source; the source must be
+//! random-access too.
+//! \sa encryptFile
+class QUOTIENT_API EncryptingDevice : public QIODevice {
+    Q_OBJECT
+public:
+    //! \brief Create a device encrypting the contents of \p source
+    //!
+    //! The new device takes the ownership of \p source. If \p source is not open, it is opened
+    //! for reading when the new device is opened.
+    explicit EncryptingDevice(QIODevice* source, QObject* parent = nullptr);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override;
+    qint64 size() const override;
+
+    //! \brief Get the metadata of the encrypted file, to be used in the event
+    //!
+    //! The hash in the metadata covers the entire ciphertext; if the device has not been read
+    //! till the end yet, the rest of the source is read and encrypted to calculate it. The device
+    //! must be open. The URL is left empty, to be filled once the file is uploaded.
+    //! \return the metadata; or an empty optional if the source couldn't be read or encrypted
+    std::optional<EncryptedFileMetadata> metadata();
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    class Private;
+    ImplPtr<Private> d;
+};
+
+//! \brief Incremental decryption of an encrypted file
+//!
+//! This is the streaming counterpart of decryptFile(): ciphertext can be passed to decrypt() in
+//! chunks of any size, as they arrive from the network, and the SHA-256 hash of the ciphertext
+//! is calculated along the way, to be checked with hashMatches() once the whole file has been
+//! passed. Memory consumption therefore doesn't depend on the file size.
+//! \note Decrypted chunks are returned before the hash can be checked; make sure to discard
+//!       the plaintext, or at least not to trust it, if hashMatches() returns false in the end.
+//! \sa decryptFile
+class QUOTIENT_API FileDecryptor {
+public:
+    explicit FileDecryptor(const EncryptedFileMetadata& metadata);
+
+    //! Check that the metadata has the key and the initialisation vector of correct sizes
+    bool isValid() const;
+
+    //! Decrypt the next chunk of the file
+    SslExpected<QByteArray> decrypt(const QByteArray& ciphertext);
+
+    //! Check the hash of all the ciphertext passed to decrypt() against the metadata
+    bool hashMatches() const;
+
+private:
+    class Private;
+    ImplPtr<Private> d;
+};
+
+} // namespace Quotient
@@ -42,6 +42,42 @@ void AbstractEventMetaType::addDerived(const AbstractEventMetaType* newType)
         << newType->matrixId << " -> " << newType->className << "; "
         << derivedTypes.size() << " derived type(s) registered for "
         << className;
+    // The new type is visible to the lookup from any metatype up the hierarchy
+    for (const AbstractEventMetaType* t = this; t != nullptr; t = t->baseType)
+        t->rebuildDispatchTable();
+}
+
+void AbstractEventMetaType::rebuildDispatchTable() const
+{
+    dispatchTable.clear();
+    genericTypes.clear();
+    // Walk the hierarchy in the same order as EventMetaType<>::doLoadFrom() does; the types
+    // are few and only register once, so there's no point in updating the table incrementally
+    const auto addTypes = [this](const auto& self, const AbstractEventMetaType* baseType) -> void {
+        for (const auto* t : baseType->derivedTypes) {
+            self(self, t);
+            if (t->isSpecific()) {
+                // A Matrix type seen for the first time gets all base types found before it
+                auto& types = dispatchTable.try_emplace(QString(t->matrixId), genericTypes)
+                                  .first->second;
+                types.push_back(t);
+            } else {
+                genericTypes.push_back(t);
+                for (auto& [_, types] : dispatchTable)
+                    types.push_back(t);
+            }
+        }
+    };
+    addTypes(addTypes, this);
+}
+
+Event* AbstractEventMetaType::loadDerived(const QJsonObject& fullJson, const QString& type) const
+{
+    const auto it = dispatchTable.find(type);
+    for (const auto* t : it != dispatchTable.cend() ? it->second : genericTypes)
+        if (auto* event = t->doLoadExact(fullJson))
+            return event;
+    return nullptr;
 }
 
 Event::Event(const QJsonObject& json)
@@ -7,6 +7,8 @@
 #include <Quotient/function_traits.h>
 #include "single_key_value.h"
 
+#include <unordered_map>
+
 namespace Quotient {
 // === event_ptr_tt<> and basic type casting facilities ===
 
@@ -49,10 +51,7 @@ public:
                                    AbstractEventMetaType* nearestBase = nullptr,
                                    const char* matrixId = nullptr)
         : className(className), baseType(nearestBase), matrixId(matrixId)
-    {
-        if (nearestBase)
-            nearestBase->addDerived(this);
-    }
+    {}
 
     void addDerived(const AbstractEventMetaType* newType);
 
@@ -68,8 +67,33 @@ protected:
     virtual bool doLoadFrom(const QJsonObject& fullJson, const QString& type,
                             Event*& event) const = 0;
 
+    //! Whether this metatype is for a specific event type (has TypeId), rather than a base one
+    virtual bool isSpecific() const = 0;
+
+    //! \brief Create an event of exactly this type, without looking into derived types
+    //!
+    //! The Matrix type is not checked; isValid(), if the event type has it, is. Base types
+    //! without isValid() never create anything here.
+    virtual Event* doLoadExact(const QJsonObject& fullJson) const = 0;
+
+    //! \brief Find and create the most specific event type derived from this one
+    //!
+    //! Uses the dispatch table to only try types that can load an event with \p type, in the same
+    //! order as the recursive lookup in doLoadFrom() would try them.
+    //! \return the new event; nullptr if none of the derived types accepted the JSON
+    Event* loadDerived(const QJsonObject& fullJson, const QString& type) const;
+
 private:
+    void rebuildDispatchTable() const;
+
     std::vector<const AbstractEventMetaType*> derivedTypes{};
+    // The dispatch table, rebuilt every time a type is registered anywhere down the hierarchy.
+    // Each Matrix type maps to the specific types registered for it, interleaved with derived
+    // base types (that can make generic events) in the order of the recursive lookup:
+    // depth-first, derived types before their bases. genericTypes only has the base types.
+    mutable std::unordered_map<QString, std::vector<const AbstractEventMetaType*>>
+        dispatchTable{};
+    mutable std::vector<const AbstractEventMetaType*> genericTypes{};
     Q_DISABLE_COPY_MOVE(AbstractEventMetaType)
 };
 
@@ -96,7 +120,15 @@ class QUOTIENT_API EventMetaType : public AbstractEventMetaType {
     // Above: can't constrain EventT to be EventClass because it's incomplete
     // at the point of EventMetaType<EventT> instantiation.
 public:
-    using AbstractEventMetaType::AbstractEventMetaType;
+    explicit EventMetaType(const char* className, AbstractEventMetaType* nearestBase = nullptr,
+                           const char* matrixId = nullptr)
+        : AbstractEventMetaType(className, nearestBase, matrixId)
+    {
+        // Registering from here rather than from the AbstractEventMetaType constructor allows
+        // the base metatype to call virtual functions of the new one (see isSpecific())
+        if (nearestBase)
+            nearestBase->addDerived(this);
+    }
 
     //! \brief Try to load an event from JSON, with dynamic type resolution
     //!
@@ -128,17 +160,48 @@ public:
     //!       (i.e., Event). If no matching type derived from RoomEvent is found,
     //!       the nested lookup returns nullptr rather than a generic RoomEvent,
     //!       so that other types derived from Event could be examined.
+    //!
+    //! Instead of actually walking the hierarchy in step 1b, the type is looked up in a table
+    //! that is prepared when event types register, so that only the types that can accept
+    //! \p type are tried - in the same order as the recursion above would try them.
     event_ptr_tt<EventT> loadFrom(const QJsonObject& fullJson,
                                   const QString& type) const
+    {
+        Event* event = nullptr;
+        bool goodEnough = false;
+        if constexpr (requires { EventT::TypeId; }) {
+            if (EventT::TypeId == type)
+                goodEnough = loadExact(fullJson, event);
+        } else {
+            event = loadDerived(fullJson, type);
+            Q_ASSERT(!event || is<EventT>(*event));
+            if (!event)
+                goodEnough = loadExact(fullJson, event);
+        }
+        return makeEventPtr(fullJson, event, goodEnough);
+    }
+
+    //! \brief Load an event from JSON walking the whole type hierarchy
+    //!
+    //! Gives the same result as loadFrom() but recurses into all derived types as described
+    //! there, without using the dispatch table. Only useful to check and benchmark the latter.
+    event_ptr_tt<EventT> loadFromHierarchy(const QJsonObject& fullJson,
+                                           const QString& type) const
     {
         Event* event = nullptr;
         const bool goodEnough = doLoadFrom(fullJson, type, event);
+        return makeEventPtr(fullJson, event, goodEnough);
+    }
+
+private:
+    static event_ptr_tt<EventT> makeEventPtr(const QJsonObject& fullJson, Event* event,
+                                             bool goodEnough)
+    {
         if (!event && goodEnough)
             return event_ptr_tt<EventT>{ new EventT(fullJson) };
         return event_ptr_tt<EventT>{ static_cast<EventT*>(event) };
     }
 
-private:
     bool doLoadFrom(const QJsonObject& fullJson, const QString& type,
                     Event*& event) const override
     {
@@ -154,6 +217,21 @@ private:
                 }
             }
         }
+        return loadExact(fullJson, event);
+    }
+
+    bool isSpecific() const override { return requires { EventT::TypeId; }; }
+
+    Event* doLoadExact(const QJsonObject& fullJson) const override
+    {
+        Event* event = nullptr;
+        loadExact(fullJson, event);
+        return event;
+    }
+
+    // Steps 2 and 4 of the algorithm described for loadFrom()
+    static bool loadExact(const QJsonObject& fullJson, Event*& event)
+    {
         if constexpr (requires { EventT::isValid; }) {
             if (!EventT::isValid(fullJson))
                 return false;
@@ -338,11 +416,23 @@ protected:
 
     explicit Event(const QJsonObject& json);
 
-    QJsonObject& editJson() { return _json; }
+    //! \brief Get the event JSON for modification
+    //!
+    //! Every call is assumed to change the JSON, making data cached from it (see
+    //! EventTemplate::content()) stale; don't keep the returned reference for longer than
+    //! the immediate modification.
+    QJsonObject& editJson()
+    {
+        ++_jsonRevision;
+        return _json;
+    }
+    //! The number of editJson() calls so far, to check whether data cached from JSON is stale
+    quint32 jsonRevision() const { return _jsonRevision; }
     virtual void dumpTo(QDebug dbg) const;
 
 private:
     QJsonObject _json;
+    quint32 _jsonRevision = 0;
 };
 using EventPtr = event_ptr_tt<Event>;
 
@@ -367,9 +457,16 @@ using Events = EventsArray<Event>;
 //! the base event type's basicJson(); if you need extra keys to be inserted
 //! you may want to bypass this template as writing the code to that effect in
 //! your class will likely be clearer and more concise.
+//!
+//! By default, content() parses the content JSON on every call. Pass `true` in
+//! \p CacheContent to have the parsed content kept in the event object instead;
+//! this pays off for event types whose content is accessed repeatedly, e.g. from
+//! UI delegates. The cached content is dropped each time the JSON is changed via
+//! editJson(). Just as the rest of the event, the cache is not thread-safe.
 //! \sa https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern
 //! \sa DEFINE_SIMPLE_EVENT
-template <typename EventT, EventClass BaseEventT, typename ContentT = void>
+template <typename EventT, EventClass BaseEventT, typename ContentT = void,
+          bool CacheContent = false>
 class EventTemplate : public BaseEventT {
     // Above: can't constrain EventT to be EventClass because it's incomplete
     // by CRTP definition.
@@ -390,7 +487,29 @@ public:
         : BaseEventT(EventT::basicJson(EventT::TypeId, toJson(c)))
     {}
 
-    ContentT content() const { return fromJson<ContentT>(this->contentJson()); }
+    //! \brief The event content, converted from JSON
+    //! \return the content by value; by const reference if \p CacheContent is `true`
+    decltype(auto) content() const
+    {
+        if constexpr (CacheContent) {
+            if (!_cache.content || _cache.jsonRevision != this->jsonRevision()) {
+                _cache.content.emplace(fromJson<ContentT>(this->contentJson()));
+                _cache.jsonRevision = this->jsonRevision();
+            }
+            return std::as_const(*_cache.content);
+        } else
+            return fromJson<ContentT>(this->contentJson());
+    }
+
+private:
+    struct ContentCache {
+        std::optional<ContentT> content;
+        quint32 jsonRevision = 0;
+    };
+    struct NoContentCache {};
+    // Event types that don't cache their content should not pay for it in size
+    [[no_unique_address]] mutable std::conditional_t<CacheContent, ContentCache, NoContentCache>
+        _cache{};
 };
 
 //! \brief Supply event metatype information in base event types
@@ -11,7 +11,7 @@ namespace Quotient {
 class QUOTIENT_API ReactionEvent
     : public EventTemplate<
           ReactionEvent, RoomEvent,
-          EventContent::SingleKeyValue<EventRelation, RelatesToKey>> {
+          EventContent::SingleKeyValue<EventRelation, RelatesToKey>, true> {
 public:
     QUO_EVENT(ReactionEvent, "m.reaction")
     static bool isValid(const QJsonObject& fullJson)
@@ -3,8 +3,6 @@
 
 #include "eventstats.h"
 
-#include "logging_categories_p.h"
-
 using namespace Quotient;
 
 EventStats EventStats::fromRange(const Room* room, const Room::rev_iter_t& from,
@@ -14,20 +12,14 @@ EventStats EventStats::fromRange(const Room* room, const Room::rev_iter_t& from,
     Q_ASSERT(to <= room->historyEdge());
     Q_ASSERT(from >= Room::rev_iter_t(room->syncEdge()));
     Q_ASSERT(from <= to);
-    QElapsedTimer et;
-    et.start();
-    const auto result =
-        accumulate(from, to, init,
-                   [room](EventStats acc, const TimelineItem& ti) {
-                       acc.notableCount += room->isEventNotable(ti);
-                       acc.highlightCount += room->notificationFor(ti).type
-                                             == Notification::Highlight;
-                       return acc;
-                   });
-    if (et.nsecsElapsed() > ProfilerMinNsecs / 10)
-        qCDebug(PROFILER).nospace()
-            << "Event statistics collection over index range [" << from->index()
-            << "," << (to - 1)->index() << "] took " << et;
+    if (from == to)
+        return init;
+
+    // Reverse iterators go from newer to older events, so indices go down from `from`
+    const auto counts = room->countEvents((to - 1)->index(), from->index());
+    auto result = init;
+    result.notableCount += counts.notableCount;
+    result.highlightCount += counts.highlightCount;
     return result;
 }
 
@@ -60,11 +52,9 @@ bool EventStats::updateOnMarkerMove(const Room* room, const marker_t& oldMarker,
     Q_ASSERT(isValidFor(room, oldMarker));
     Q_ASSERT(oldMarker > newMarker);
 
-    // A bit of optimisation: only calculate the difference if the marker moved
-    // less than half the remaining timeline ahead; otherwise, recalculation
-    // over the remaining timeline will very likely be faster.
-    if (oldMarker != room->historyEdge()
-        && oldMarker - newMarker < newMarker - marker_t(room->syncEdge())) {
+    // Counting over a range costs the same regardless of its length, so only recalculate
+    // the statistics entirely if they have been estimated so far
+    if (oldMarker != room->historyEdge()) {
         const auto removedStats = fromRange(room, newMarker, oldMarker);
         Q_ASSERT(notableCount >= removedStats.notableCount
                  && highlightCount >= removedStats.highlightCount);
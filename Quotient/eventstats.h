@@ -62,7 +62,9 @@ public:
     //! This is a factory that returns an EventStats instance with counts of
     //! notable and highlighted events between \p from and \p to reverse
     //! timeline iterators; the \p init parameter allows to override
-    //! the initial statistics object and start from other values.
+    //! the initial statistics object and start from other values. The events
+    //! in the range are not visited; the room keeps the counters indexed,
+    //! so this takes logarithmic time on the timeline size.
     static EventStats fromRange(const Room* room, const marker_t& from,
                                 const marker_t& to,
                                 const EventStats& init = { 0, 0, false });
@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include "eventitem.h"
+
+#include <vector>
+
+namespace Quotient::_impl {
+
+//! \brief Prefix sums of notable and highlighted events over timeline indices
+//!
+//! The timeline grows both ways from index 0, so there are two Fenwick trees: one for indices
+//! from 0 upwards and one for negative indices, from -1 downwards. Both setting a value and
+//! counting events over a range take O(log n) time; setting a value beyond the current end of
+//! either tree grows that tree. Values at indices that have left the timeline are not cleared;
+//! they are overwritten if the index gets reused.
+class EventStatsIndex {
+public:
+    using index_t = TimelineItem::index_t;
+
+    struct Counts {
+        qsizetype notable = 0;
+        qsizetype highlight = 0;
+
+        Counts& operator+=(const Counts& rhs)
+        {
+            notable += rhs.notable;
+            highlight += rhs.highlight;
+            return *this;
+        }
+        friend Counts operator+(Counts lhs, const Counts& rhs) { return lhs += rhs; }
+        friend Counts operator-(const Counts& lhs, const Counts& rhs)
+        {
+            return { lhs.notable - rhs.notable, lhs.highlight - rhs.highlight };
+        }
+        bool operator==(const Counts&) const = default;
+    };
+
+    void set(index_t index, Counts counts)
+    {
+        if (index >= 0)
+            set(forward, size_t(index) + 1, counts);
+        else
+            set(backward, size_t(-index), counts);
+    }
+
+    //! Count events with indices from \p first to \p last, inclusive
+    Counts count(index_t first, index_t last) const
+    {
+        Q_ASSERT(first <= last);
+        return countUpTo(last) - countUpTo(first - 1);
+    }
+
+    void clear()
+    {
+        forward.clear();
+        backward.clear();
+    }
+
+private:
+    // Both trees use 1-based positions: tree[pos - 1] holds the sum over (pos - lowBit(pos), pos]
+    using tree_t = std::vector<Counts>;
+    tree_t forward;
+    tree_t backward;
+
+    static size_t lowBit(size_t pos) { return pos & (~pos + 1); }
+
+    //! Sum over positions 1 to \p pos; positions beyond the tree end count as zeros
+    static Counts prefix(const tree_t& tree, size_t pos)
+    {
+        Counts result;
+        for (pos = std::min(pos, tree.size()); pos > 0; pos -= lowBit(pos))
+            result += tree[pos - 1];
+        return result;
+    }
+
+    static void set(tree_t& tree, size_t pos, Counts counts)
+    {
+        if (pos <= tree.size()) {
+            const auto delta = counts - (prefix(tree, pos) - prefix(tree, pos - 1));
+            if (delta == Counts{})
+                return;
+            for (; pos <= tree.size(); pos += lowBit(pos))
+                tree[pos - 1] += delta;
+            return;
+        }
+        // Grow the tree, filling any gap with zeros; each new node sums the values it covers
+        while (tree.size() < pos) {
+            const auto newPos = tree.size() + 1;
+            const auto value = newPos == pos ? counts : Counts{};
+            tree.push_back(value + prefix(tree, newPos - 1)
+                           - prefix(tree, newPos - lowBit(newPos)));
+        }
+    }
+
+    //! Count events with indices up to \p index, inclusive
+    Counts countUpTo(index_t index) const
+    {
+        const auto backwardTotal = prefix(backward, backward.size());
+        if (index >= 0)
+            return backwardTotal + prefix(forward, size_t(index) + 1);
+        // Indices from -1 down to index + 1 are excluded
+        return backwardTotal - prefix(backward, size_t(-index) - 1);
+    }
+};
+
+} // namespace Quotient::_impl
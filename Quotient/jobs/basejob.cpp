@@ -9,6 +9,7 @@
 #include "../connectiondata.h"
 #include "../networkaccessmanager.h"
 
+#include <QtCore/QDeadlineTimer>
 #include <QtCore/QMetaEnum>
 #include <QtCore/QPointer>
 #include <QtCore/QRegularExpression>
@@ -80,7 +81,6 @@ public:
         , needsToken(nt)
     {
         timer.setSingleShot(true);
-        retryTimer.setSingleShot(true);
     }
 
     ~Private()
@@ -142,12 +142,17 @@ public:
     QMessageLogger::CategoryFunction logCat = &JOBS;
 
     QTimer timer;
-    QTimer retryTimer;
+    //! The time of the next attempt, as scheduled by the connection
+    QDeadlineTimer retryDeadline;
 
     static constexpr auto errorStrategy = std::to_array<const JobTimeoutConfig>(
         { { 30s, 2s }, { 60s, 5s }, { 150s, 30s } });
     int maxRetries = int(errorStrategy.size());
     int retriesTaken = 0;
+    //! The job making the network request, if this job shares it (see follow())
+    QPointer<BaseJob> sourceJob;
+    //! The number of jobs that share the network request of this one
+    int followers = 0;
 
     [[nodiscard]] const JobTimeoutConfig& getCurrentTimeoutConfig() const
     {
@@ -199,16 +204,11 @@ BaseJob::BaseJob(HttpVerb verb, const QString& name, QByteArray endpoint,
 {
     setObjectName(name);
     connect(&d->timer, &QTimer::timeout, this, &BaseJob::timeout);
-    connect(&d->retryTimer, &QTimer::timeout, this, [this] {
-        qCDebug(d->logCat) << "Retrying" << this;
-        d->connection->submit(this);
-    });
 }
 
 BaseJob::~BaseJob()
 {
     stop();
-    d->retryTimer.stop(); // See #398
     qCDebug(d->logCat) << this << "destroyed";
 }
 
@@ -381,6 +381,7 @@ void BaseJob::sendRequest()
         return;
     }
     Q_ASSERT(d->connection && status().code == Pending);
+    d->retryDeadline = {};
     d->needsToken |= d->connection->needsToken(objectName());
     auto req = d->prepareRequest();
     emit aboutToSendRequest(&req);
@@ -538,7 +539,7 @@ BaseJob::Status BaseJob::prepareError(Status currentStatus)
         else // We still have to figure some reasonable interval
             retryAfterMs = getNextRetryMs();
 
-        d->connection->limitRate(milliseconds(retryAfterMs));
+        d->connection->limitRate(this, milliseconds(retryAfterMs));
 
         return { TooManyRequests, msg };
     }
@@ -579,8 +580,7 @@ QJsonValue BaseJob::takeValueFromJson(const QString& key)
 
 void BaseJob::stop()
 {
-    // This method is (also) used to semi-finalise the job before retrying; so
-    // stop the timeout timer but keep the retry timer running.
+    // This method is (also) used to semi-finalise the job before retrying
     d->timer.stop();
     if (d->reply) {
         d->reply->disconnect(this); // Ignore whatever comes from the reply
@@ -616,18 +616,16 @@ void BaseJob::finishJob()
     case IncorrectResponse:
     case Timeout:
         if (d->retriesTaken < d->maxRetries) {
-            // TODO: The whole retrying thing should be put to
-            // Connection(Manager) otherwise independently retrying jobs make a
-            // bit of notification storm towards the UI.
-            const seconds retryIn = error() == Timeout ? 0s
-                                                       : getNextRetryInterval();
+            // The connection schedules retries of all its jobs, so that jobs
+            // failing together don't come back to the server together
             ++d->retriesTaken;
+            setStatus(Pending, "Pending retry"_ls);
+            const auto retryIn = d->connection->scheduleRetry(this, d->retriesTaken);
+            d->retryDeadline = QDeadlineTimer(retryIn);
             qCWarning(d->logCat).nospace()
                 << this << ": retry #" << d->retriesTaken << " in "
-                << retryIn.count() << " s";
-            setStatus(Pending, "Pending retry"_ls);
-            d->retryTimer.start(retryIn);
-            emit retryScheduled(d->retriesTaken, milliseconds(retryIn).count());
+                << retryIn.count() << " ms";
+            emit retryScheduled(d->retriesTaken, retryIn.count());
             return;
         }
         [[fallthrough]];
@@ -635,7 +633,11 @@ void BaseJob::finishJob()
     }
 
     Q_ASSERT(status().code != Pending);
+    reportResult();
+}
 
+void BaseJob::reportResult()
+{
     // Notify those interested in any completion of the job including abandon()
     emit finished(this);
 
@@ -671,8 +673,7 @@ BaseJob::duration_ms_t BaseJob::getNextRetryMs() const
 
 milliseconds BaseJob::timeToRetry() const
 {
-    return d->retryTimer.isActive() ? d->retryTimer.remainingTimeAsDuration()
-                                    : 0s;
+    return std::chrono::ceil<milliseconds>(d->retryDeadline.remainingTimeAsDuration());
 }
 
 BaseJob::duration_ms_t BaseJob::millisToRetry() const
@@ -809,12 +810,41 @@ void BaseJob::forceResult(QJsonDocument resultDoc, Status s)
     QMetaObject::invokeMethod(this, [this] { finishJob(); }, Qt::QueuedConnection);
 }
 
+BaseJob::Status BaseJob::adoptResult(const BaseJob&) { return Success; }
+
+void BaseJob::follow(BaseJob* sourceJob, ConnectionData* connData)
+{
+    d->connection = connData;
+    d->inBackground = sourceJob->isBackground();
+    d->sourceJob = sourceJob;
+    ++sourceJob->d->followers;
+    setStatus(Pending);
+    d->promise.start();
+    connect(sourceJob, &BaseJob::finished, this, [this, sourceJob] {
+        d->sourceJob = nullptr;
+        if (sourceJob->status().code == Abandoned) {
+            abandon(); // Abandoned by the connection, not by the followers
+            return;
+        }
+        d->rawResponse = sourceJob->d->rawResponse;
+        d->jsonResponse = sourceJob->d->jsonResponse;
+        d->errorUrl = sourceJob->d->errorUrl;
+        setStatus(sourceJob->status().good() ? adoptResult(*sourceJob) : sourceJob->status());
+        reportResult();
+    });
+}
+
 void BaseJob::abandon()
 {
+    if (auto* sourceJob = std::exchange(d->sourceJob, nullptr).data()) {
+        sourceJob->disconnect(this);
+        // Nobody else needs the network request once the last follower is gone
+        if (--sourceJob->d->followers == 0 && isJobPending(sourceJob))
+            sourceJob->abandon();
+    }
     beforeAbandon();
     d->timer.stop();
-    d->retryTimer.stop(); // In case abandon() was called between retries
-    setStatus(Abandoned);
+    setStatus(Abandoned); // The connection won't retry the job if it waits for that
     if (d->reply)
         d->reply->disconnect(this);
     emit finished(this);
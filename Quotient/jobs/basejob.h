@@ -247,6 +247,9 @@ public Q_SLOTS:
     //! This aborts waiting for a reply from the server (if there was
     //! any pending) and deletes the job object. No result signals
     //! (result, success, failure) are emitted, only finished() is.
+    //! If the job shares its network request with other jobs (see
+    //! ConnectionData::shareInFlightGet()), the request is only aborted
+    //! once all of them are abandoned.
     void abandon();
 
 Q_SIGNALS:
@@ -405,6 +408,16 @@ protected:
      */
     virtual Status prepareError(Status currentStatus);
 
+    /*! \brief Take over the successful result of another job
+     *
+     * This is called instead of prepareResult() on jobs that share the network
+     * request made by \p sourceJob, a job of the same type with the same
+     * parameters (see ConnectionData::shareInFlightGet()). The response body
+     * has already been copied by then; overrides should copy whatever else
+     * prepareResult() stores in the job. The base implementation returns Success.
+     */
+    virtual Status adoptResult(const BaseJob& sourceJob);
+
     /*! \brief Get direct access to the JSON response object in the job
      *
      * This allows to implement deserialisation with "move" semantics for parts
@@ -474,6 +487,9 @@ private:
 
     void stop();
     void finishJob();
+    void reportResult();
+    //! Wait for the result of \p sourceJob instead of sending a request
+    void follow(BaseJob* sourceJob, ConnectionData* connData);
     QFuture<void> future();
 
     class Private;
@@ -8,7 +8,7 @@
 #include "../csapi/authed-content-repo.h"
 #include "../csapi/content-repo.h"
 
-#include <Quotient/events/filesourceinfo.h>
+#include "../e2ee/filecrypto.h"
 
 #include "../logging_categories_p.h"
 
@@ -34,6 +34,7 @@ public:
     QScopedPointer<QFile> tempFile;
 
     std::optional<EncryptedFileMetadata> encryptedFileMetadata;
+    std::optional<FileDecryptor> decryptor;
 };
 
 QUrl DownloadFileJob::makeRequestUrl(const HomeserverData& hsData, const QUrl& mxcUri)
@@ -86,11 +87,23 @@ void DownloadFileJob::doPrepare(const ConnectionData* connectionData)
         setStatus(FileError, "Could not open the temporary download file"_ls);
         return;
     }
+    if (d->encryptedFileMetadata.has_value()
+        && !FileDecryptor(*d->encryptedFileMetadata).isValid()) {
+        setStatus(FileError, "Invalid encryption parameters for the file"_ls);
+        return;
+    }
     qCDebug(JOBS) << "Downloading to" << d->tempFile->fileName();
 }
 
 void DownloadFileJob::onSentRequest(QNetworkReply* reply)
 {
+    // Start over, in case the request is being retried; a shorter reply this time
+    // should not leave the tail of the previous attempt in the file
+    d->tempFile->resize(0);
+    d->tempFile->seek(0);
+    if (d->encryptedFileMetadata.has_value())
+        d->decryptor.emplace(*d->encryptedFileMetadata);
+
     connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply] {
         if (!status().good())
             return;
@@ -110,11 +123,21 @@ void DownloadFileJob::onSentRequest(QNetworkReply* reply)
         if (!status().good())
             return;
         auto bytes = reply->read(reply->bytesAvailable());
-        if (!bytes.isEmpty())
-            d->tempFile->write(bytes);
-        else
+        if (bytes.isEmpty()) {
             qCWarning(JOBS) << "Unexpected empty chunk when downloading from"
                             << reply->url() << "to" << d->tempFile->fileName();
+            return;
+        }
+        if (d->decryptor) {
+            // Decrypt chunks as they come, instead of the whole file at the end
+            auto decrypted = d->decryptor->decrypt(bytes);
+            if (!decrypted.has_value()) {
+                setStatus(FileError, "Could not decrypt the downloaded data"_ls);
+                return;
+            }
+            bytes = decrypted.move_value_or({});
+        }
+        d->tempFile->write(bytes);
     });
 }
 
@@ -122,55 +145,52 @@ void DownloadFileJob::beforeAbandon()
 {
     if (d->targetFile)
         d->targetFile->remove();
-    d->tempFile->remove();
-}
-
-void decryptFile(QFile& sourceFile, const EncryptedFileMetadata& metadata,
-                 QFile& targetFile)
-{
-    sourceFile.seek(0);
-    const auto encrypted = sourceFile.readAll(); // TODO: stream decryption
-    const auto decrypted = decryptFile(encrypted, metadata);
-    targetFile.write(decrypted);
+    if (!d->tempFile->fileName().isEmpty()) // Jobs sharing a request may not have opened it
+        d->tempFile->remove();
 }
 
 BaseJob::Status DownloadFileJob::prepareResult()
 {
+    // The temporary file already has the plaintext, only its integrity remains to be checked
+    if (d->decryptor && !d->decryptor->hashMatches()) {
+        beforeAbandon();
+        return { IncorrectResponse, "The downloaded file is corrupted"_ls };
+    }
     if (d->targetFile) {
-        if (d->encryptedFileMetadata.has_value()) {
-            decryptFile(*d->tempFile, *d->encryptedFileMetadata, *d->targetFile);
-            d->tempFile->remove();
-        } else {
-            d->targetFile->close();
-            if (!d->targetFile->remove()) {
-                qWarning(JOBS) << "Failed to remove the target file placeholder";
-                return { FileError, "Couldn't finalise the download"_ls };
-            }
-            if (!d->tempFile->rename(d->targetFile->fileName())) {
-                qWarning(JOBS) << "Failed to rename" << d->tempFile->fileName()
-                                << "to" << d->targetFile->fileName();
-                return { FileError, "Couldn't finalise the download"_ls };
-            }
+        d->targetFile->close();
+        if (!d->targetFile->remove()) {
+            qWarning(JOBS) << "Failed to remove the target file placeholder";
+            return { FileError, "Couldn't finalise the download"_ls };
         }
-    } else {
-        if (d->encryptedFileMetadata.has_value()) {
-            QTemporaryFile tempTempFile; // Assuming it to be next to tempFile
-            decryptFile(*d->tempFile, *d->encryptedFileMetadata, tempTempFile);
-            d->tempFile->close();
-            if (!d->tempFile->remove()) {
-                qWarning(JOBS)
-                    << "Failed to remove the decrypted file placeholder";
-                return { FileError, "Couldn't finalise the download"_ls };
-            }
-            if (!tempTempFile.rename(d->tempFile->fileName())) {
-                qWarning(JOBS) << "Failed to rename" << tempTempFile.fileName()
-                                << "to" << d->tempFile->fileName();
-                return { FileError, "Couldn't finalise the download"_ls };
-            }
-        } else {
-            d->tempFile->close();
+        if (!d->tempFile->rename(d->targetFile->fileName())) {
+            qWarning(JOBS) << "Failed to rename" << d->tempFile->fileName()
+                            << "to" << d->targetFile->fileName();
+            return { FileError, "Couldn't finalise the download"_ls };
         }
+    } else {
+        d->tempFile->close();
     }
     qDebug(JOBS) << "Saved a file as" << targetFileName();
     return Success;
 }
+
+BaseJob::Status DownloadFileJob::adoptResult(const BaseJob& sourceJob)
+{
+    // Shared jobs don't have a target file; each gets its own copy of the temporary file,
+    // as requesters are free to move or change it
+    QFile sourceFile(static_cast<const DownloadFileJob&>(sourceJob).targetFileName());
+    if (!sourceFile.open(QIODevice::ReadOnly) || !d->tempFile->open(QIODevice::ReadWrite)) {
+        qCWarning(JOBS) << "Couldn't copy" << sourceFile.fileName() << "for" << this;
+        return { FileError, "Couldn't copy the downloaded file"_ls };
+    }
+    static constexpr qint64 ChunkSize = 1024 * 1024;
+    while (!sourceFile.atEnd())
+        if (const auto chunk = sourceFile.read(ChunkSize);
+            chunk.isEmpty() || d->tempFile->write(chunk) != chunk.size()) {
+            qCWarning(JOBS) << "Couldn't copy" << sourceFile.fileName() << "to"
+                            << d->tempFile->fileName();
+            return { FileError, "Couldn't copy the downloaded file"_ls };
+        }
+    d->tempFile->close();
+    return Success;
+}
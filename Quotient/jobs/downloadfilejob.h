@@ -28,5 +28,6 @@ private:
     void onSentRequest(QNetworkReply* reply) override;
     void beforeAbandon() override;
     Status prepareResult() override;
+    Status adoptResult(const BaseJob& sourceJob) override;
 };
 } // namespace Quotient
@@ -9,6 +9,9 @@
 #include "../connectiondata.h"
 #include "../logging_categories_p.h"
 
+#include <QtCore/QBuffer>
+#include <QtGui/QImageReader>
+
 using namespace Quotient;
 
 QUrl MediaThumbnailJob::makeRequestUrl(const HomeserverData& hsData, const QUrl& mxcUri,
@@ -50,11 +53,18 @@ MediaThumbnailJob::MediaThumbnailJob(const QUrl& mxcUri, QSize requestedSize,
                         requestedSize, animated)
 {}
 
-QImage MediaThumbnailJob::thumbnail() const { return _thumbnail; }
+QImage MediaThumbnailJob::thumbnail() const
+{
+    if (_thumbnail.isNull() && !_thumbnailData.isEmpty())
+        _thumbnail.loadFromData(_thumbnailData);
+    return _thumbnail;
+}
+
+QByteArray MediaThumbnailJob::thumbnailData() const { return _thumbnailData; }
 
 QImage MediaThumbnailJob::scaledThumbnail(QSize toSize) const
 {
-    return _thumbnail.scaled(toSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return thumbnail().scaled(toSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
 }
 
 void MediaThumbnailJob::doPrepare(const ConnectionData* connectionData)
@@ -67,8 +77,19 @@ void MediaThumbnailJob::doPrepare(const ConnectionData* connectionData)
 
 BaseJob::Status MediaThumbnailJob::prepareResult()
 {
-    if (_thumbnail.loadFromData(reply()->readAll()))
+    // Only check the image header here, leaving the actual decoding until it's needed
+    _thumbnailData = reply()->readAll();
+    QBuffer buffer(&_thumbnailData);
+    if (QImageReader(&buffer).canRead())
         return Success;
 
+    _thumbnailData.clear();
+
     return { IncorrectResponse, QStringLiteral("Could not read image data") };
 }
+
+BaseJob::Status MediaThumbnailJob::adoptResult(const BaseJob& sourceJob)
+{
+    _thumbnailData = static_cast<const MediaThumbnailJob&>(sourceJob)._thumbnailData;
+    return Success;
+}
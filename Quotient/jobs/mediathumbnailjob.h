@@ -21,7 +21,13 @@ public:
     MediaThumbnailJob(const QUrl& mxcUri, QSize requestedSize,
                       std::optional<bool> animated = std::nullopt);
 
+    //! \brief The thumbnail image, decoded on the first call
+    //!
+    //! Since decoding can take a while, consider getting thumbnailData() and decoding it
+    //! on a worker thread instead.
     QImage thumbnail() const;
+    //! The thumbnail as received from the server, in its original format
+    QByteArray thumbnailData() const;
     [[deprecated("Use thumbnail().scaled() instead")]]
     QImage scaledThumbnail(QSize toSize) const;
 
@@ -30,10 +36,12 @@ private:
     QString mediaId;
     QSize requestedSize;
     std::optional<bool> animated;
-    QImage _thumbnail;
+    QByteArray _thumbnailData;
+    mutable QImage _thumbnail;
 
     void doPrepare(const ConnectionData* connectionData) override;
     Status prepareResult() override;
+    Status adoptResult(const BaseJob& sourceJob) override;
 };
 
 inline auto collectResponse(const MediaThumbnailJob* j) { return j->thumbnail(); }
@@ -35,6 +35,9 @@ SyncJob::SyncJob(const QString& since, const Filter& filter, int timeout,
 
 BaseJob::Status SyncJob::prepareResult()
 {
+    if (deferParsing)
+        return Success;
+
     d.parseJson(jsonData());
     if (Q_LIKELY(d.unresolvedRooms().isEmpty()))
         return Success;
@@ -17,10 +17,20 @@ public:
 
     SyncData takeData() { return std::move(d); }
 
+    //! \brief Leave the response unparsed
+    //!
+    //! If set before the response arrives, the job does not fill SyncData in prepareResult(),
+    //! leaving jsonData() intact; the caller is then responsible for parsing it (typically,
+    //! on a worker thread) instead of calling takeData().
+    //! \sa Connection::setBackgroundSyncParsing
+    void setDeferredParsing(bool deferredParsing) { deferParsing = deferredParsing; }
+    bool deferredParsing() const { return deferParsing; }
+
 protected:
     Status prepareResult() override;
 
 private:
     SyncData d;
+    bool deferParsing = false;
 };
 } // namespace Quotient
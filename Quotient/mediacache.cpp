@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "mediacache.h"
+
+#include "logging_categories_p.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QStringBuilder>
+#include <QtCore/QTemporaryFile>
+
+#include <list>
+
+using namespace Quotient;
+
+namespace {
+constexpr auto StagingFileSuffix = ".part"_ls;
+
+QString fileNameFor(const MediaCache::Key& key)
+{
+    auto id = key.serverName % u'/' % key.mediaId;
+    if (!key.thumbnailSize.isEmpty())
+        id += u'@' % QString::number(key.thumbnailSize.width()) % u'x'
+              % QString::number(key.thumbnailSize.height());
+    return QString::fromLatin1(
+        QCryptographicHash::hash(id.toUtf8(), QCryptographicHash::Sha256).toHex());
+}
+} // anonymous namespace
+
+class Q_DECL_HIDDEN MediaCache::Private {
+public:
+    QMutex mutex;
+    QString location = cacheLocation("media"_ls);
+    qint64 maxSize = DefaultMaxSize;
+    bool cacheEncryptedMedia = true;
+
+    //! Whether the items in the cache directory have been indexed
+    bool scanned = false;
+    qint64 totalSize = 0;
+    //! Names of cached files, most recently used first
+    std::list<QString> lru;
+    QHash<QString, std::pair<std::list<QString>::iterator, qint64>> items;
+
+    QString filePath(const QString& fileName) const { return QDir(location).filePath(fileName); }
+
+    //! \brief Index the cache directory, if not done yet
+    //!
+    //! Modification times of files serve as last access times, so the LRU order survives
+    //! restarts. The index is only built when the cache is used for the first time.
+    void scan()
+    {
+        if (scanned)
+            return;
+        scanned = true;
+        lru.clear();
+        items.clear();
+        totalSize = 0;
+        const QDir dir(location);
+        for (const auto& fi : dir.entryInfoList(QDir::Files, QDir::Time)) { // Newest first
+            if (fi.fileName().endsWith(StagingFileSuffix)) {
+                // A leftover of an interrupted download
+                QFile::remove(fi.filePath());
+                continue;
+            }
+            lru.push_back(fi.fileName());
+            items.insert(fi.fileName(), { std::prev(lru.end()), fi.size() });
+            totalSize += fi.size();
+        }
+        qCDebug(NETWORK) << "Media cache in" << location << "has" << items.size() << "item(s),"
+                         << totalSize << "bytes";
+        evict();
+    }
+
+    void removeItem(const QString& fileName)
+    {
+        const auto it = items.constFind(fileName);
+        if (it == items.cend())
+            return;
+        QFile::remove(filePath(fileName));
+        totalSize -= it->second;
+        lru.erase(it->first);
+        items.erase(it);
+    }
+
+    void evict()
+    {
+        while (totalSize > maxSize && !lru.empty())
+            removeItem(lru.back());
+    }
+};
+
+MediaCache& MediaCache::instance()
+{
+    static MediaCache cache;
+    return cache;
+}
+
+MediaCache::MediaCache() : d(makeImpl<Private>()) {}
+
+void MediaCache::setLocation(const QString& dirPath)
+{
+    const QMutexLocker _(&d->mutex);
+    if (const QDir dir(dirPath); !dir.exists())
+        dir.mkpath("."_ls);
+    d->location = dirPath;
+    d->scanned = false;
+}
+
+QString MediaCache::location() const
+{
+    const QMutexLocker _(&d->mutex);
+    return d->location;
+}
+
+void MediaCache::setMaxSize(qint64 maxSize)
+{
+    const QMutexLocker _(&d->mutex);
+    d->maxSize = maxSize;
+    d->scan();
+    d->evict();
+}
+
+qint64 MediaCache::maxSize() const
+{
+    const QMutexLocker _(&d->mutex);
+    return d->maxSize;
+}
+
+void MediaCache::setCacheEncryptedMedia(bool enabled)
+{
+    const QMutexLocker _(&d->mutex);
+    d->cacheEncryptedMedia = enabled;
+}
+
+bool MediaCache::cacheEncryptedMedia() const
+{
+    const QMutexLocker _(&d->mutex);
+    return d->cacheEncryptedMedia;
+}
+
+qint64 MediaCache::size() const
+{
+    const QMutexLocker _(&d->mutex);
+    d->scan();
+    return d->totalSize;
+}
+
+std::unique_ptr<QFile> MediaCache::open(const Key& key)
+{
+    const QMutexLocker _(&d->mutex);
+    d->scan();
+    const auto fileName = fileNameFor(key);
+    const auto it = d->items.constFind(fileName);
+    if (it == d->items.cend())
+        return nullptr;
+    auto file = std::make_unique<QFile>(d->filePath(fileName));
+    if (!file->open(QIODevice::ReadOnly)) {
+        qCWarning(NETWORK) << "Couldn't open cached media file" << file->fileName();
+        d->removeItem(fileName);
+        return nullptr;
+    }
+    d->lru.splice(d->lru.begin(), d->lru, it->first);
+    file->setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    return file;
+}
+
+void MediaCache::remove(const Key& key)
+{
+    const QMutexLocker _(&d->mutex);
+    d->scan();
+    d->removeItem(fileNameFor(key));
+}
+
+std::unique_ptr<QTemporaryFile> MediaCache::makeStagingFile() const
+{
+    const QMutexLocker _(&d->mutex);
+    d->scan(); // Make sure the scan won't remove the new file as a leftover
+    auto file = std::make_unique<QTemporaryFile>(d->filePath("XXXXXX"_ls + StagingFileSuffix));
+    if (!file->open()) {
+        qCWarning(NETWORK) << "Couldn't create a file in the media cache at" << d->location;
+        return nullptr;
+    }
+    return file;
+}
+
+void MediaCache::store(const Key& key, QTemporaryFile& stagingFile)
+{
+    const QMutexLocker _(&d->mutex);
+    if (d->maxSize == 0)
+        return; // The staging file will be removed along with its object
+    d->scan();
+    const auto fileName = fileNameFor(key);
+    d->removeItem(fileName); // In case it has been downloaded concurrently
+    stagingFile.close();
+    if (!stagingFile.rename(d->filePath(fileName))) {
+        qCWarning(NETWORK) << "Couldn't store" << stagingFile.fileName() << "in the media cache";
+        return;
+    }
+    stagingFile.setAutoRemove(false);
+    d->lru.push_front(fileName);
+    const auto size = stagingFile.size();
+    d->items.insert(fileName, { d->lru.begin(), size });
+    d->totalSize += size;
+    d->evict();
+}
+
+void MediaCache::clear()
+{
+    const QMutexLocker _(&d->mutex);
+    d->scan();
+    while (!d->lru.empty())
+        d->removeItem(d->lru.front());
+}
@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include "util.h"
+
+#include <QtCore/QSize>
+#include <QtCore/QString>
+
+#include <memory>
+
+class QFile;
+class QTemporaryFile;
+
+namespace Quotient {
+//! \brief A persistent cache of downloaded media, shared by all connections
+//!
+//! Media items are stored in files named after the hash of the item key (the server name,
+//! the media id and, for thumbnails, the requested size); since Matrix content is immutable,
+//! the key identifies the content uniquely. The cache has a size budget; once it's exceeded,
+//! least recently used items are removed. Encrypted media are stored as they come from
+//! the server, i.e. still encrypted, and only if enabled by setCacheEncryptedMedia(); MxcReply
+//! checks their hash while decrypting and removes the item if it doesn't match.
+//!
+//! NetworkAccessManager uses the cache for `mxc:` requests: hits are served straight from
+//! disk, misses are stored as they get downloaded. All methods are thread-safe.
+class QUOTIENT_API MediaCache {
+public:
+    struct Key {
+        QString serverName;
+        QString mediaId;
+        //! The requested thumbnail size; empty for the full media item
+        QSize thumbnailSize{};
+    };
+
+    static constexpr qint64 DefaultMaxSize = 512 * 1024 * 1024;
+
+    //! Get the process-wide cache instance
+    static MediaCache& instance();
+
+    //! \brief Set the directory to store media in
+    //!
+    //! The default is the `media` directory in the application cache location. Items already
+    //! cached in the previous location are left there.
+    void setLocation(const QString& dirPath);
+    QString location() const;
+
+    //! Set the size budget of the cache, in bytes; 0 disables caching
+    void setMaxSize(qint64 maxSize);
+    qint64 maxSize() const;
+
+    //! \brief Enable or disable caching of encrypted media
+    //!
+    //! Encrypted media are cached in encrypted form; this is enabled by default
+    void setCacheEncryptedMedia(bool enabled);
+    bool cacheEncryptedMedia() const;
+
+    //! The total size of the cached items, in bytes
+    qint64 size() const;
+
+    //! \brief Open a cached item for reading
+    //!
+    //! Opening an item makes it the most recently used one. The content is not checked
+    //! in any way; for encrypted items, that is up to the code decrypting them.
+    //! \return the opened file, or nullptr if the item is not in the cache
+    std::unique_ptr<QFile> open(const Key& key);
+
+    //! Remove an item from the cache, e.g. if it turns out to be corrupted
+    void remove(const Key& key);
+
+    //! \brief Create a temporary file to download an item to
+    //!
+    //! Once the download completes, pass the file to store(); if it's destroyed before that,
+    //! it's removed.
+    std::unique_ptr<QTemporaryFile> makeStagingFile() const;
+
+    //! Move a file obtained from makeStagingFile() to the cache as the given item
+    void store(const Key& key, QTemporaryFile& stagingFile);
+
+    //! Remove all items from the cache
+    void clear();
+
+private:
+    MediaCache();
+
+    class Private;
+    ImplPtr<Private> d;
+};
+} // namespace Quotient
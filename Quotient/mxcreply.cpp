@@ -3,38 +3,150 @@
 
 #include "mxcreply.h"
 
-#include <QtCore/QBuffer>
+#include "logging_categories_p.h"
 
-#include "events/filesourceinfo.h"
+#include "e2ee/filecrypto.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
+
+#include <algorithm>
+#include <cstring>
 
 using namespace Quotient;
 
+namespace {
+constexpr qint64 CachedChunkSize = 65'536;
+}
+
 class Q_DECL_HIDDEN MxcReply::Private
 {
 public:
-    QNetworkReply* m_reply;
-    QIODevice* m_device;
+    //! The network reply, if the content is downloaded
+    QNetworkReply* m_reply = nullptr;
+    //! The file with the content, if it's taken from the cache
+    QFile* m_cachedFile = nullptr;
+    //! Only set for encrypted files
+    std::optional<FileDecryptor> m_decryptor = std::nullopt;
+    //! The data that has arrived but hasn't been read yet (decrypted, if necessary)
+    QByteArray m_buffer = {};
+    qsizetype m_bufferPos = 0;
+    //! The cache key and the file to stage downloaded content in, if it should be cached
+    std::optional<MediaCache::Key> m_cacheKey = std::nullopt;
+    std::unique_ptr<QTemporaryFile> m_stagingFile = nullptr;
+
+    //! Add a chunk of content to the buffer, decrypting it if needed
+    bool append(const QByteArray& chunk)
+    {
+        if (chunk.isEmpty())
+            return true;
+        // Drop what's been read already before appending
+        m_buffer.remove(0, std::exchange(m_bufferPos, 0));
+        if (!m_decryptor) {
+            m_buffer += chunk;
+            return true;
+        }
+        auto decrypted = m_decryptor->decrypt(chunk);
+        if (!decrypted.has_value())
+            return false;
+        m_buffer += decrypted.move_value_or({});
+        return true;
+    }
+
+    //! Take whatever has arrived from the network so far
+    bool takeAvailable()
+    {
+        const auto chunk = m_reply->readAll();
+        // The cache stores the content as it comes, i.e. encrypted for encrypted files
+        if (m_stagingFile && !chunk.isEmpty() && m_stagingFile->write(chunk) != chunk.size())
+            m_stagingFile.reset(); // Don't cache partially written files
+        return append(chunk);
+    }
 };
 
 MxcReply::MxcReply(QNetworkReply* reply,
                    const EncryptedFileMetadata& fileMetadata)
-    : d(makeImpl<Private>(reply, fileMetadata.isValid() ? nullptr : reply))
+    : d(makeImpl<Private>(reply))
 {
     reply->setParent(this);
-    connect(d->m_reply, &QNetworkReply::finished, this, [this, fileMetadata] {
-        setError(d->m_reply->error(), d->m_reply->errorString());
-
-        if (fileMetadata.isValid()) {
-            auto buffer = new QBuffer(this);
-            buffer->setData(decryptFile(d->m_reply->readAll(), fileMetadata));
-            buffer->open(ReadOnly);
-            d->m_device = buffer;
+    if (fileMetadata.isValid()) {
+        d->m_decryptor.emplace(fileMetadata);
+        if (!d->m_decryptor->isValid()) {
+            setError(QNetworkReply::UnknownContentError,
+                     tr("Invalid encryption parameters for the file"));
+            // Let the consumer connect to finished() first
+            QMetaObject::invokeMethod(d->m_reply, &QNetworkReply::abort, Qt::QueuedConnection);
+        }
+    }
+    // Pass the data on as it arrives, so that consumers could start decoding it right away
+    setOpenMode(ReadOnly | Unbuffered);
+    connect(d->m_reply, &QNetworkReply::readyRead, this, [this] {
+        if (error() != NoError)
+            return;
+        if (!d->takeAvailable()) {
+            setError(QNetworkReply::UnknownContentError, tr("Could not decrypt the file"));
+            d->m_reply->abort();
+            return;
         }
-        setOpenMode(ReadOnly);
+        emit readyRead();
+    });
+    connect(d->m_reply, &QNetworkReply::downloadProgress, this,
+            &QNetworkReply::downloadProgress);
+    connect(d->m_reply, &QNetworkReply::finished, this, [this] {
+        if (error() == NoError)
+            setError(d->m_reply->error(), d->m_reply->errorString());
+
+        if (error() == NoError && !(d->takeAvailable()
+                                    && (!d->m_decryptor || d->m_decryptor->hashMatches()))) {
+            // Whatever has been read already can't be taken back; tell the consumer to
+            // discard it
+            setError(QNetworkReply::UnknownContentError, tr("The file is corrupted"));
+            d->m_buffer.clear();
+            d->m_bufferPos = 0;
+        }
+
+        if (error() == NoError && d->m_cacheKey && d->m_stagingFile)
+            MediaCache::instance().store(*d->m_cacheKey, *d->m_stagingFile);
+        d->m_stagingFile.reset();
+        setFinished(true);
         emit finished();
     });
 }
 
+MxcReply::MxcReply(QNetworkReply* reply, const EncryptedFileMetadata& fileMetadata,
+                   MediaCache::Key cacheKey)
+    : MxcReply(reply, fileMetadata)
+{
+    d->m_cacheKey = std::move(cacheKey);
+    d->m_stagingFile = MediaCache::instance().makeStagingFile();
+}
+
+MxcReply::MxcReply(std::unique_ptr<QFile> cachedFile, const EncryptedFileMetadata& fileMetadata,
+                   MediaCache::Key cacheKey)
+    : d(makeImpl<Private>(nullptr, cachedFile.release()))
+{
+    d->m_cachedFile->setParent(this);
+    d->m_cacheKey = std::move(cacheKey);
+    // The hash is checked in readData() once the file has been read through
+    if (fileMetadata.isValid()) {
+        d->m_decryptor.emplace(fileMetadata);
+        if (!d->m_decryptor->isValid()) {
+            setError(QNetworkReply::UnknownContentError,
+                     tr("Invalid encryption parameters for the file"));
+        }
+    }
+    setOpenMode(ReadOnly | Unbuffered);
+    setAttribute(QNetworkRequest::SourceIsFromCacheAttribute, true);
+    // The whole content is available straight away; the data is read (and decrypted)
+    // in chunks as the consumer asks for it
+    QMetaObject::invokeMethod(this, [this] {
+            emit downloadProgress(d->m_cachedFile->size(), d->m_cachedFile->size());
+            setFinished(true);
+            emit readyRead();
+            emit finished();
+        }, Qt::QueuedConnection);
+}
+
 MxcReply::MxcReply()
     : d(ZeroImpl<Private>())
 {
@@ -53,10 +165,34 @@ MxcReply::MxcReply()
 
 qint64 MxcReply::readData(char *data, qint64 maxSize)
 {
-    if(d != nullptr && d->m_device != nullptr) {
-        return d->m_device->read(data, maxSize);
+    if (d == nullptr || (d->m_cachedFile && error() != NoError))
+        return -1;
+    if (d->m_cachedFile && !d->m_decryptor)
+        return d->m_cachedFile->read(data, maxSize);
+    if (d->m_cachedFile && d->m_bufferPos == d->m_buffer.size()) {
+        const auto chunk = d->m_cachedFile->read(std::min(maxSize, CachedChunkSize));
+        if (!d->append(chunk)) {
+            setError(QNetworkReply::UnknownContentError, tr("Could not decrypt the file"));
+            return -1;
+        }
+        // Check the hash before giving away the last chunk, as it's done for network replies
+        if (!chunk.isEmpty() && d->m_cachedFile->atEnd() && !d->m_decryptor->hashMatches()) {
+            qCWarning(NETWORK) << "Cached media file" << d->m_cachedFile->fileName()
+                               << "is corrupted, removing it";
+            MediaCache::instance().remove(*d->m_cacheKey);
+            setError(QNetworkReply::UnknownContentError, tr("The file is corrupted"));
+            d->m_buffer.clear();
+            d->m_bufferPos = 0;
+            return -1;
+        }
     }
-    return -1;
+
+    const auto size = std::min(maxSize, qint64(d->m_buffer.size() - d->m_bufferPos));
+    if (size == 0)
+        return isFinished() || d->m_cachedFile ? -1 : 0;
+    std::memcpy(data, d->m_buffer.constData() + d->m_bufferPos, static_cast<size_t>(size));
+    d->m_bufferPos += size;
+    return size;
 }
 
 void MxcReply::abort()
@@ -68,8 +204,10 @@ void MxcReply::abort()
 
 qint64 MxcReply::bytesAvailable() const
 {
-    if (d != nullptr && d->m_device != nullptr) {
-        return d->m_device->bytesAvailable() + QNetworkReply::bytesAvailable();
-    }
-    return 0;
+    if (d == nullptr)
+        return 0;
+    auto available = d->m_buffer.size() - d->m_bufferPos + QNetworkReply::bytesAvailable();
+    if (d->m_cachedFile)
+        available += d->m_cachedFile->bytesAvailable();
+    return available;
 }
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "mediacache.h"
 #include "util.h"
 
 #include "events/filesourceinfo.h"
@@ -17,6 +18,15 @@ public:
     explicit MxcReply();
     explicit MxcReply(QNetworkReply* reply,
                       const EncryptedFileMetadata& fileMetadata);
+    //! Create a reply that stores the downloaded content in MediaCache as \p cacheKey
+    explicit MxcReply(QNetworkReply* reply, const EncryptedFileMetadata& fileMetadata,
+                      MediaCache::Key cacheKey);
+    //! \brief Create a reply that serves the content from a file in MediaCache
+    //!
+    //! For encrypted files, the hash is checked once the whole file has been read; if it
+    //! doesn't match, the reply fails and \p cacheKey is removed from the cache.
+    explicit MxcReply(std::unique_ptr<QFile> cachedFile,
+                      const EncryptedFileMetadata& fileMetadata, MediaCache::Key cacheKey);
 
     qint64 bytesAvailable() const override;
 
@@ -5,12 +5,15 @@
 
 #include "connectiondata.h"
 #include "logging_categories_p.h"
+#include "mediacache.h"
 #include "mxcreply.h"
 
 #include "events/filesourceinfo.h"
 #include "jobs/downloadfilejob.h" // For DownloadFileJob::makeRequestUrl() only
+#include "jobs/mediathumbnailjob.h" // For MediaThumbnailJob::makeRequestUrl() only
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QSettings>
 #include <QtCore/QStringBuilder>
@@ -168,16 +171,31 @@ QNetworkReply* NetworkAccessManager::createRequest(
         return new MxcReply();
     }
 
+    const auto& fileMetadata = FileMetadataMap::lookup(
+        query.queryItemValue(QStringLiteral("room_id")),
+        query.queryItemValue(QStringLiteral("event_id")));
+    // Thumbnails are requested by adding the desired size to the mxc URL
+    MediaCache::Key cacheKey{ url.authority(), url.path().mid(1),
+                              QSize(query.queryItemValue(QStringLiteral("width")).toInt(),
+                                    query.queryItemValue(QStringLiteral("height")).toInt()) };
+    auto& cache = MediaCache::instance();
+    const auto useCache = op == GetOperation && cache.maxSize() > 0
+                          && (!fileMetadata.isValid() || cache.cacheEncryptedMedia());
+    if (useCache)
+        if (auto cachedFile = cache.open(cacheKey))
+            return new MxcReply(std::move(cachedFile), fileMetadata, std::move(cacheKey));
+
     // Convert mxc:// URL into normal http(s) for the given homeserver
     QNetworkRequest rewrittenRequest(request);
-    rewrittenRequest.setUrl(DownloadFileJob::makeRequestUrl(hsData, url));
+    rewrittenRequest.setUrl(
+        cacheKey.thumbnailSize.isEmpty()
+            ? DownloadFileJob::makeRequestUrl(hsData, url)
+            : MediaThumbnailJob::makeRequestUrl(hsData, url, cacheKey.thumbnailSize));
 
     auto* implReply = QNetworkAccessManager::createRequest(op, rewrittenRequest);
     implReply->ignoreSslErrors(d.getIgnoredSslErrors());
-    const auto& fileMetadata = FileMetadataMap::lookup(
-        query.queryItemValue(QStringLiteral("room_id")),
-        query.queryItemValue(QStringLiteral("event_id")));
-    return new MxcReply(implReply, fileMetadata);
+    return useCache ? new MxcReply(implReply, fileMetadata, std::move(cacheKey))
+                    : new MxcReply(implReply, fileMetadata);
 }
 
 QStringList NetworkAccessManager::supportedSchemesImplementation() const
@@ -0,0 +1,364 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "pushruleevaluator.h"
+
+#include "logging_categories_p.h"
+#include "room.h"
+#include "roommember.h"
+
+#include "events/roompowerlevelsevent.h"
+
+#include <QtCore/QRegularExpression>
+
+#include <algorithm>
+
+using namespace Quotient;
+
+namespace {
+
+//! \brief Split a dot-separated event property path
+//!
+//! Dots and backslashes that are part of a key are escaped with a backslash.
+QStringList splitPath(const QString& key)
+{
+    QStringList parts{ QString() };
+    for (auto it = key.cbegin(); it != key.cend(); ++it) {
+        if (*it == u'\\' && it + 1 != key.cend() && (it[1] == u'.' || it[1] == u'\\'))
+            parts.back() += *++it;
+        else if (*it == u'.')
+            parts.append(QString());
+        else
+            parts.back() += *it;
+    }
+    return parts;
+}
+
+QJsonValue valueAtPath(const QJsonObject& json, const QStringList& path)
+{
+    QJsonValue value = json;
+    for (const auto& part : path) {
+        if (!value.isObject())
+            return QJsonValue::Undefined;
+        value = value.toObject().value(part);
+    }
+    return value;
+}
+
+//! \brief A glob-style pattern, as defined in the Matrix spec
+//!
+//! The match is case-insensitive; the pattern should either match the whole value or, if
+//! \p matchWords is true, any part of it bounded by non-word characters or the value ends.
+class GlobMatcher {
+public:
+    GlobMatcher() = default;
+    GlobMatcher(const QString& pattern, bool matchWords)
+        : literal(pattern), isLiteral(!matchWords && !pattern.contains(u'*')
+                                      && !pattern.contains(u'?'))
+    {
+        if (!isLiteral) {
+            regex.setPattern(matchWords ? "(?<!\\w)(?:"_ls + toRegex(pattern) + ")(?!\\w)"_ls
+                                        : "\\A(?:"_ls + toRegex(pattern) + ")\\z"_ls);
+            regex.setPatternOptions(QRegularExpression::CaseInsensitiveOption
+                                    | QRegularExpression::UseUnicodePropertiesOption
+                                    | QRegularExpression::DotMatchesEverythingOption);
+            regex.optimize();
+        }
+    }
+
+    static QString toRegex(const QString& pattern)
+    {
+        return QRegularExpression::escape(pattern)
+            .replace("\\*"_ls, ".*"_ls)
+            .replace("\\?"_ls, "."_ls);
+    }
+
+    bool isLiteralPattern() const { return isLiteral; }
+    const QString& pattern() const { return literal; }
+
+    bool matches(const QString& value) const
+    {
+        return isLiteral ? value.compare(literal, Qt::CaseInsensitive) == 0
+                         : regex.match(value).hasMatch();
+    }
+
+private:
+    QString literal;
+    bool isLiteral = true;
+    QRegularExpression regex;
+};
+
+//! Check whether \p name occurs in \p text as a whole word, ignoring case
+bool containsWord(const QString& text, const QString& name)
+{
+    if (name.isEmpty())
+        return false;
+    const auto isWordChar = [](QChar c) { return c.isLetterOrNumber() || c == u'_'; };
+    for (auto pos = text.indexOf(name, 0, Qt::CaseInsensitive); pos != -1;
+         pos = text.indexOf(name, pos + 1, Qt::CaseInsensitive)) {
+        const auto end = pos + name.size();
+        if ((pos == 0 || !isWordChar(text[pos - 1])) && (end == text.size() || !isWordChar(text[end])))
+            return true;
+    }
+    return false;
+}
+
+struct Condition {
+    enum Kind {
+        EventMatch,
+        PropertyIs,
+        PropertyContains,
+        ContainsDisplayName,
+        MemberCount,
+        SenderPermission,
+        Unsupported
+    };
+    Kind kind = Unsupported;
+    QStringList path{};
+    GlobMatcher matcher{};
+    QJsonValue value{};
+    QString permissionKey{};
+    // For MemberCount: the member count should be greater (1), less (-1), or equal (0) to
+    // `count`; or-equal comparisons are turned into strict ones by adjusting `count`
+    int comparison = 0;
+    int count = 0;
+};
+
+Condition compileCondition(const PushCondition& pc)
+{
+    Condition c;
+    if (pc.kind == "event_match"_ls) {
+        c.kind = Condition::EventMatch;
+        c.path = splitPath(pc.key);
+        c.matcher = GlobMatcher(pc.pattern, pc.key == "content.body"_ls);
+    } else if (pc.kind == "event_property_is"_ls || pc.kind == "event_property_contains"_ls) {
+        c.kind = pc.kind == "event_property_is"_ls ? Condition::PropertyIs
+                                                   : Condition::PropertyContains;
+        c.path = splitPath(pc.key);
+        c.value = QJsonValue::fromVariant(pc.value);
+    } else if (pc.kind == "contains_display_name"_ls) {
+        c.kind = Condition::ContainsDisplayName;
+    } else if (pc.kind == "room_member_count"_ls) {
+        c.kind = Condition::MemberCount;
+        auto is = QStringView(pc.is);
+        bool orEqual = false;
+        if (is.startsWith(u'<') || is.startsWith(u'>')) {
+            c.comparison = is.startsWith(u'<') ? -1 : 1;
+            is = is.mid(1);
+            if (is.startsWith(u'=')) {
+                orEqual = true;
+                is = is.mid(1);
+            }
+        } else if (is.startsWith(u"=="))
+            is = is.mid(2);
+        bool ok = false;
+        c.count = is.toInt(&ok);
+        if (!ok) {
+            qCWarning(MAIN) << "Malformed room_member_count condition:" << pc.is;
+            c.kind = Condition::Unsupported;
+        } else if (orEqual)
+            c.count -= c.comparison; // `>= n` is `> n - 1`, `<= n` is `< n + 1`
+    } else if (pc.kind == "sender_notification_permission"_ls) {
+        c.kind = Condition::SenderPermission;
+        c.permissionKey = pc.key;
+    } else
+        qCDebug(MAIN) << "Unsupported push condition kind:" << pc.kind;
+    return c;
+}
+
+Notification::Type notificationFromActions(const QVector<QVariant>& actions)
+{
+    bool notify = false;
+    bool highlight = false;
+    for (const auto& action : actions) {
+        if (action.typeId() == QMetaType::QString) {
+            const auto actionName = action.toString();
+            notify |= actionName == "notify"_ls || actionName == "coalesce"_ls;
+        } else if (const auto tweak = action.toMap();
+                   tweak.value("set_tweak"_ls).toString() == "highlight"_ls)
+            highlight = tweak.value("value"_ls, true).toBool();
+    }
+    if (!notify)
+        return Notification::None;
+    return highlight ? Notification::Highlight : Notification::Basic;
+}
+
+struct CompiledRule {
+    QString ruleId;
+    std::vector<Condition> conditions;
+    Notification::Type notification = Notification::None;
+};
+
+struct EvaluationContext {
+    const Room* room;
+    const RoomEvent& event;
+    const QJsonObject& json;
+};
+
+bool conditionHolds(const Condition& c, const EvaluationContext& ctx)
+{
+    switch (c.kind) {
+    case Condition::EventMatch: {
+        const auto value = valueAtPath(ctx.json, c.path);
+        return value.isString() && c.matcher.matches(value.toString());
+    }
+    case Condition::PropertyIs:
+        return valueAtPath(ctx.json, c.path) == c.value;
+    case Condition::PropertyContains:
+        return valueAtPath(ctx.json, c.path).toArray().contains(c.value);
+    case Condition::ContainsDisplayName:
+        return containsWord(ctx.json[ContentKey]["body"_ls].toString(),
+                            ctx.room->localMember().displayName());
+    case Condition::MemberCount: {
+        const auto memberCount = ctx.room->joinedCount();
+        return c.comparison < 0   ? memberCount < c.count
+               : c.comparison > 0 ? memberCount > c.count
+                                  : memberCount == c.count;
+    }
+    case Condition::SenderPermission:
+        if (const auto* plEvt = ctx.room->currentState().get<RoomPowerLevelsEvent>()) {
+            // Only the `room` key is defined by the spec so far, with a default of 50
+            const auto requiredLevel = c.permissionKey == "room"_ls ? plEvt->roomNotification()
+                                                                   : 50;
+            return plEvt->powerLevelForUser(ctx.event.senderId()) >= requiredLevel;
+        }
+        return false;
+    case Condition::Unsupported:
+        break;
+    }
+    return false;
+}
+
+//! \brief Rules of one kind that have arbitrary conditions, in the order of priority
+//!
+//! Most of the default rules require a specific event type; these rules are only checked
+//! against events of that type.
+class ConditionalRules {
+public:
+    void compile(const QVector<PushRule>& rules)
+    {
+        for (const auto& rule : rules) {
+            if (!rule.enabled)
+                continue;
+            CompiledRule compiled{ rule.ruleId, {}, notificationFromActions(rule.actions) };
+            QString requiredType;
+            for (const auto& pc : rule.conditions) {
+                auto& c = compiled.conditions.emplace_back(compileCondition(pc));
+                if (c.kind == Condition::EventMatch && c.path == QStringList{ TypeKey }
+                    && c.matcher.isLiteralPattern())
+                    requiredType = c.matcher.pattern().toLower();
+            }
+            const auto ruleIndex = int(this->rules.size());
+            this->rules.push_back(std::move(compiled));
+            if (requiredType.isEmpty())
+                anyTypeRules.push_back(ruleIndex);
+            else
+                rulesByType[requiredType].push_back(ruleIndex);
+        }
+        // Rules that don't require a type apply to all types; merge them in, keeping the order
+        for (auto& typeRules : rulesByType) {
+            std::vector<int> merged;
+            merged.reserve(typeRules.size() + anyTypeRules.size());
+            std::merge(typeRules.cbegin(), typeRules.cend(), anyTypeRules.cbegin(),
+                       anyTypeRules.cend(), std::back_inserter(merged));
+            typeRules = std::move(merged);
+        }
+    }
+
+    std::optional<Notification::Type> match(const EvaluationContext& ctx,
+                                            const QString& eventType) const
+    {
+        auto it = rulesByType.constFind(eventType);
+        if (it == rulesByType.cend() && !eventType.isLower())
+            it = rulesByType.constFind(eventType.toLower());
+        for (const auto ruleIndex : it != rulesByType.cend() ? *it : anyTypeRules) {
+            const auto& rule = rules[size_t(ruleIndex)];
+            if (std::ranges::all_of(rule.conditions,
+                                    [&ctx](const Condition& c) { return conditionHolds(c, ctx); }))
+                return rule.notification;
+        }
+        return std::nullopt;
+    }
+
+private:
+    std::vector<CompiledRule> rules;
+    QHash<QString, std::vector<int>> rulesByType;
+    std::vector<int> anyTypeRules;
+};
+
+} // namespace
+
+class Q_DECL_HIDDEN PushRuleEvaluator::Private {
+public:
+    ConditionalRules overrideRules;
+    // Content rules in the order of priority, along with a matcher for any of them
+    std::vector<std::pair<GlobMatcher, Notification::Type>> contentRules;
+    QRegularExpression anyContentRule;
+    QHash<QString, Notification::Type> roomRules;
+    QHash<QString, Notification::Type> senderRules;
+    ConditionalRules underrideRules;
+};
+
+PushRuleEvaluator::PushRuleEvaluator() : d(makeImpl<Private>()) {}
+
+void PushRuleEvaluator::setRuleset(const PushRuleset& ruleset)
+{
+    d = makeImpl<Private>();
+    d->overrideRules.compile(ruleset.override);
+
+    QStringList contentPatterns;
+    for (const auto& rule : ruleset.content)
+        if (rule.enabled) {
+            d->contentRules.emplace_back(GlobMatcher(rule.pattern, true),
+                                         notificationFromActions(rule.actions));
+            contentPatterns.append(GlobMatcher::toRegex(rule.pattern));
+        }
+    if (!contentPatterns.isEmpty()) {
+        d->anyContentRule.setPattern("(?<!\\w)(?:"_ls + contentPatterns.join(u'|') + ")(?!\\w)"_ls);
+        d->anyContentRule.setPatternOptions(QRegularExpression::CaseInsensitiveOption
+                                            | QRegularExpression::UseUnicodePropertiesOption
+                                            | QRegularExpression::DotMatchesEverythingOption);
+        d->anyContentRule.optimize();
+    }
+
+    // If there are several rules for the same room or sender, the first one takes precedence
+    for (const auto& rule : ruleset.room)
+        if (rule.enabled && !d->roomRules.contains(rule.ruleId))
+            d->roomRules.insert(rule.ruleId, notificationFromActions(rule.actions));
+    for (const auto& rule : ruleset.sender)
+        if (rule.enabled && !d->senderRules.contains(rule.ruleId))
+            d->senderRules.insert(rule.ruleId, notificationFromActions(rule.actions));
+
+    d->underrideRules.compile(ruleset.underride);
+}
+
+Notification PushRuleEvaluator::evaluate(const Room* room, const RoomEvent& event) const
+{
+    const auto& json = event.fullJson();
+    const auto eventType = event.matrixType();
+    const EvaluationContext ctx{ room, event, json };
+
+    if (const auto n = d->overrideRules.match(ctx, eventType))
+        return { *n };
+
+    if (!d->contentRules.empty()) {
+        if (const auto body = json[ContentKey]["body"_ls];
+            body.isString() && d->anyContentRule.match(body.toString()).hasMatch()) {
+            const auto bodyText = body.toString();
+            for (const auto& [matcher, notification] : d->contentRules)
+                if (matcher.matches(bodyText))
+                    return { notification };
+        }
+    }
+
+    if (const auto it = d->roomRules.constFind(room->id()); it != d->roomRules.cend())
+        return { *it };
+
+    if (const auto it = d->senderRules.constFind(event.senderId()); it != d->senderRules.cend())
+        return { *it };
+
+    if (const auto n = d->underrideRules.match(ctx, eventType))
+        return { *n };
+
+    return { Notification::None };
+}
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include "csapi/definitions/push_ruleset.h"
+
+#include "util.h"
+
+namespace Quotient {
+class Room;
+class RoomEvent;
+struct Notification;
+
+//! \brief Client-side evaluation of the account's push rules
+//!
+//! The rules from `m.push_rules` account data are compiled once, when set: glob patterns are
+//! turned into matchers, room and sender rules are put in hash maps, override and underride
+//! rules are grouped by the event type they require (most of them require one) and all content
+//! rules get a combined matcher that rejects non-matching message bodies in one pass. Evaluating
+//! an event therefore only examines the rules that can possibly apply to it, rather than all
+//! of them. Since the evaluation runs on the client, it works for encrypted events as well,
+//! once they're decrypted.
+//! \sa https://spec.matrix.org/latest/client-server-api/#push-rules
+class QUOTIENT_API PushRuleEvaluator {
+public:
+    PushRuleEvaluator();
+
+    //! Compile the rules from the `global` scope of `m.push_rules` account data
+    void setRuleset(const PushRuleset& ruleset);
+
+    //! \brief Find the first rule matching \p event and return the notification it implies
+    //! \return Notification::None if no rule matches or the matching rule doesn't notify;
+    //!         Notification::Highlight if it notifies with the `highlight` tweak set;
+    //!         Notification::Basic if it notifies otherwise
+    Notification evaluate(const Room* room, const RoomEvent& event) const;
+
+private:
+    class Private;
+    ImplPtr<Private> d;
+};
+} // namespace Quotient
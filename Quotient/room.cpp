@@ -14,14 +14,17 @@
 #include "converters.h"
 #include "database.h"
 #include "eventstats.h"
+#include "eventstatsindex_p.h"
 #include "keyverificationsession.h"
 #include "logging_categories_p.h"
+#include "pushruleevaluator.h"
 #include "qt_connection_util.h"
 #include "quotient_common.h"
 #include "ranges_extras.h"
 #include "roommember.h"
 #include "roomstateview.h"
 #include "syncdata.h"
+#include "timelinestore.h"
 #include "user.h"
 
 #include "csapi/account-data.h"
@@ -39,6 +42,7 @@
 #include "csapi/tags.h"
 
 #include "e2ee/e2ee_common.h"
+#include "e2ee/filecrypto.h"
 #include "e2ee/qolmaccount.h"
 #include "e2ee/qolminboundsession.h"
 
@@ -67,11 +71,14 @@
 #include <QtCore/QPointer>
 #include <QtCore/QRegularExpression>
 #include <QtCore/QStringBuilder> // for efficient string concats (operator%)
-#include <QtCore/QTemporaryFile>
+#include <QtCore/QTimer>
+#include <QtConcurrent/QtConcurrentMap>
 
 #include <array>
 #include <cmath>
 #include <functional>
+#include <list>
+#include <unordered_set>
 
 using namespace Quotient;
 using namespace std::placeholders;
@@ -112,6 +119,8 @@ public:
     QString displayname;
     Avatar avatar;
     QHash<QString, Notification> notifications;
+    //! Notable and highlighted events by timeline index, to count them for EventStats
+    _impl::EventStatsIndex statsIndex;
     qsizetype serverHighlightCount = 0;
     // Starting up with estimate event statistics as there's zero knowledge
     // about the timeline.
@@ -119,8 +128,13 @@ public:
 
     // For storing a list of current member names for the purpose of disambiguation.
     QMultiHash<QString, QString> memberNameMap;
+    // Ids of members partitioned by membership, each list sorted; membersLeft also has banned
+    // and knocking users. Maintained in (pre)processStateEvent() or, for bulk updates,
+    // rebuilt with resetMemberLists().
+    QStringList membersJoined;
     QStringList membersInvited;
     QStringList membersLeft;
+    bool resettingMemberLists = false;
     QStringList membersTyping;
 
     QHash<QString, QSet<QString>> eventIdReadUsers;
@@ -140,6 +154,20 @@ public:
     //! requesting further historical batches.
     std::optional<QString> prevBatch = QString();
     int lastRequestedHistorySize = 0;
+    //! \brief The sequence number of the timeline front in the local timeline cache
+    //!
+    //! Cached events with smaller numbers have not been loaded to the timeline yet.
+    //! `std::nullopt` until the cache is looked at for the first time.
+    //! \sa TimelineStore
+    std::optional<qint64> cachedFrontSeq;
+    //! Whether the local timeline cache may have events older than the timeline front
+    bool hasCachedHistory = true;
+    //! \brief Previous batch tokens of events that start batches received from the server
+    //!
+    //! Only collected while the timeline size is limited, so that evictOldEvents() can leave
+    //! the timeline front at an event that the history can be requested back from.
+    //! \sa Connection::timelineSizeLimit
+    QHash<QString, QString> batchPrevTokens;
     JobHandle<GetRoomEventsJob> eventsHistoryJob;
     JobHandle<GetMembersByRoomJob> allMembersJob;
     //! Map from megolm sessionId to set of eventIds
@@ -203,6 +231,11 @@ public:
     void insertMemberIntoMap(const QString& memberId);
     void removeMemberFromMap(const QString& memberId);
 
+    QStringList& memberIdsList(Membership membership);
+    void addMemberId(Membership membership, const QString& memberId);
+    void removeMemberId(Membership membership, const QString& memberId);
+    void resetMemberLists();
+
     // This updates the room displayname field (which is the way a room
     // should be shown in the room list); called whenever the list of
     // members, the room name (m.room.name) or canonical alias change.
@@ -215,6 +248,10 @@ public:
     Timeline::const_iterator syncEdge() const { return timeline.cend(); }
 
     JobHandle<GetRoomEventsJob> getPreviousContent(int limit = 10, const QString &filter = {});
+    void initCachedFrontSeq(TimelineStore& store);
+    bool loadCachedHistory(int limit);
+    std::function<void(TimelineStore&)> prepareCachedTimeline(TimelineStore& store,
+                                                              int maxEvents);
 
     Changes updateStateFrom(StateEvents&& events)
     {
@@ -222,6 +259,12 @@ public:
         if (!events.empty()) {
             QElapsedTimer et;
             et.start();
+            // For larger batches (initial sync, loading from the cache or the full member
+            // list), sorting member lists once is cheaper than inserting members one by one
+            if (events.size() > 100) {
+                emit q->memberListsAboutToReset();
+                resettingMemberLists = true;
+            }
             for (auto&& eptr : std::move(events)) {
                 const auto& evt = *eptr;
                 Q_ASSERT(evt.isStateEvent());
@@ -231,6 +274,8 @@ public:
                         std::move(eptr);
                 }
             }
+            if (resettingMemberLists)
+                resetMemberLists();
             if (events.size() > 9 || et.nsecsElapsed() >= ProfilerMinNsecs)
                 qCDebug(PROFILER)
                     << "Updated" << q->objectName() << "room state from"
@@ -248,6 +293,8 @@ public:
 
     Changes addNewMessageEvents(RoomEvents&& events);
     std::pair<Changes, rev_iter_t> addHistoricalMessageEvents(RoomEvents&& events);
+    //! Drop the oldest events from the timeline if it's larger than Connection::timelineSizeLimit
+    void evictOldEvents();
 
     Changes updateStatsFromSyncData(const SyncRoomData &data, bool fromCache);
     void postprocessChanges(Changes changes, bool saveState = true);
@@ -281,6 +328,13 @@ public:
                                     bool deferStatsUpdate = false);
     Changes setFullyReadMarker(const QString &eventId);
     Changes updateStats(const rev_iter_t& from, const rev_iter_t& to);
+    //! Put the current notability and highlight status of \p ti to statsIndex
+    void updateStatsIndex(const TimelineItem& ti);
+    //! \brief Update statsIndex for an event that changed after being counted
+    //!
+    //! Unlike updateStatsIndex(), this also applies the change to the unread and partially
+    //! read statistics, if they include the event.
+    Changes reevaluateStats(const TimelineItem& ti);
     bool markMessagesAsRead(const rev_iter_t& upToMarker);
 
     void getAllMembers();
@@ -327,18 +381,98 @@ public:
 
     void setTags(TagsMap&& newTags);
 
+    //! \brief The cache file to load the full room state from
+    //!
+    //! Non-empty when only the room preview has been loaded from the cache so far.
+    //! \sa Connection::setDeferredStateLoading
+    QString deferredStateFile;
+    void loadDeferredState();
+
     QJsonObject toJson() const;
+    QJsonObject toPreviewJson() const;
 
     bool isLocalMember(const QString& memberId) const { return memberId == connection->userId(); }
 
-    std::unordered_map<QByteArray, QOlmInboundGroupSession> groupSessions;
+    //! \brief Recently used inbound megolm sessions, the most recently used first
+    //!
+    //! Other sessions only exist in the database, in pickled form, until they're needed.
+    std::list<std::pair<QByteArray, QOlmInboundGroupSession>> groupSessions;
+    std::unordered_map<QByteArray, decltype(groupSessions)::iterator> groupSessionsIndex;
+    //! Ids of sessions that have been looked up and not found in the database
+    QSet<QByteArray> unknownGroupSessionIds;
+    static constexpr size_t MaxLoadedGroupSessions = 50;
+
     std::optional<QOlmOutboundGroupSession> currentOutboundMegolmSession = {};
+    //! Whether currentOutboundMegolmSession has changed since it was last saved
+    bool outboundMegolmSessionDirty = false;
+    //! Restarted with each message, to save the outbound session once sending settles down
+    QTimer outboundMegolmSessionSaveTimer;
+    //! \brief Devices that have received the current outbound session, by user id
+    //!
+    //! Loaded from the database when a session becomes current, then updated as the session
+    //! key gets delivered.
+    QHash<QString, QSet<QString>> devicesWithKey;
+    //! The outbound session devicesWithKey refers to
+    QByteArray devicesWithKeySessionId;
+    //! \brief Devices of room members that have not received the current session yet
+    //!
+    //! This is reset and calculated anew when the member list or the device lists change.
+    std::optional<QMultiHash<QString, QString>> devicesWithoutKey;
+    //! \brief Devices the current outbound session is being sent to, by user id
+    //!
+    //! These are left out of devicesWithoutKey, so that messages sent while the key is on its
+    //! way don't send it again; if sending fails, the devices get back there.
+    QHash<QString, QSet<QString>> devicesWithKeyInFlight;
+
+    //! \brief Get an inbound megolm session, loading it from the database if necessary
+    //! \return the session, or nullptr if there's none with \p sessionId; the pointer stays
+    //!         valid until the next trimGroupSessions() call
+    QOlmInboundGroupSession* findGroupSession(const QByteArray& sessionId)
+    {
+        if (const auto it = groupSessionsIndex.find(sessionId); it != groupSessionsIndex.end()) {
+            groupSessions.splice(groupSessions.begin(), groupSessions, it->second);
+            return &it->second->second;
+        }
+        if (unknownGroupSessionIds.contains(sessionId))
+            return nullptr;
+        auto session = connection->loadRoomMegolmSession(q, sessionId);
+        if (!session) {
+            unknownGroupSessionIds.insert(sessionId);
+            return nullptr;
+        }
+        return &storeGroupSession(sessionId, std::move(*session));
+    }
+
+    QOlmInboundGroupSession& storeGroupSession(const QByteArray& sessionId,
+                                               QOlmInboundGroupSession&& session)
+    {
+        unknownGroupSessionIds.remove(sessionId);
+        if (const auto it = groupSessionsIndex.find(sessionId); it != groupSessionsIndex.end()) {
+            groupSessions.splice(groupSessions.begin(), groupSessions, it->second);
+            return it->second->second = std::move(session);
+        }
+        groupSessions.emplace_front(sessionId, std::move(session));
+        groupSessionsIndex.try_emplace(sessionId, groupSessions.begin());
+        return groupSessions.front().second;
+    }
+
+    //! \brief Unload the least recently used sessions beyond MaxLoadedGroupSessions
+    //!
+    //! Sessions are saved to the database as soon as they're added so there's nothing to
+    //! write back. This invalidates the pointers returned by findGroupSession() before.
+    void trimGroupSessions()
+    {
+        while (groupSessions.size() > MaxLoadedGroupSessions) {
+            groupSessionsIndex.erase(groupSessions.back().first);
+            groupSessions.pop_back();
+        }
+    }
 
     bool addInboundGroupSession(QByteArray sessionId, QByteArray sessionKey,
                                 const QString& senderId,
                                 const QByteArray& olmSessionId, const QByteArray& senderKey, const QByteArray& senderEdKey)
     {
-        if (groupSessions.contains(sessionId)) {
+        if (findGroupSession(sessionId)) {
             qCWarning(E2EE) << "Inbound Megolm session" << sessionId << "already exists";
             return false;
         }
@@ -354,30 +488,39 @@ public:
         megolmSession.setOlmSessionId(olmSessionId);
         qCWarning(E2EE) << "Adding inbound session" << sessionId;
         connection->saveMegolmSession(q, megolmSession, senderKey, senderEdKey);
-        groupSessions.try_emplace(sessionId, std::move(megolmSession));
+        storeGroupSession(sessionId, std::move(megolmSession));
         return true;
     }
 
-    QString groupSessionDecryptMessage(const QByteArray& ciphertext,
-                                       const QByteArray& sessionId,
-                                       const QString& eventId,
-                                       const QDateTime& timestamp,
-                                       const QString& senderId)
+    //! \brief Find the megolm session to decrypt an event from \p senderId
+    //! \return the session, or nullptr if it's unknown or belongs to another sender
+    QOlmInboundGroupSession* inboundSessionFor(const QByteArray& sessionId,
+                                               const QString& senderId)
     {
-        auto groupSessionIt = groupSessions.find(sessionId);
-        if (groupSessionIt == groupSessions.end()) {
+        auto* senderSession = findGroupSession(sessionId);
+        if (!senderSession) {
             // qCWarning(E2EE) << "Unable to decrypt event" << eventId
             //               << "The sender's device has not sent us the keys for "
             //                  "this message";
             // TODO: request the keys
-            return {};
+            return nullptr;
         }
-        auto& senderSession = groupSessionIt->second;
-        if (senderSession.senderId() != "BACKUP"_ls && senderSession.senderId() != senderId) {
+        if (senderSession->senderId() != "BACKUP"_ls && senderSession->senderId() != senderId) {
             qCWarning(E2EE) << "Sender from event does not match sender from session";
-            return {};
+            return nullptr;
         }
-        auto decryptResult = senderSession.decrypt(ciphertext);
+        return senderSession;
+    }
+
+    //! \brief Check the result of decrypting an event for errors and replays
+    //!
+    //! Unlike the decryption itself, this has to run on the room's thread as it uses
+    //! the database.
+    //! \return the plaintext, or an empty string if the event should stay undecrypted
+    QString acceptDecrypted(const QOlmInboundGroupSession& senderSession,
+                            const QOlmExpected<std::pair<QByteArray, uint32_t>>& decryptResult,
+                            const QString& eventId, const QDateTime& timestamp)
+    {
         if(!decryptResult) {
             qCWarning(E2EE) << "Unable to decrypt event" << eventId
             << "with matching megolm session:" << decryptResult.error();
@@ -401,6 +544,51 @@ public:
         return QString::fromUtf8(content);
     }
 
+    QString groupSessionDecryptMessage(const QByteArray& ciphertext,
+                                       const QByteArray& sessionId,
+                                       const QString& eventId,
+                                       const QDateTime& timestamp,
+                                       const QString& senderId)
+    {
+        auto* senderSession = inboundSessionFor(sessionId, senderId);
+        if (!senderSession)
+            return {};
+        return acceptDecrypted(*senderSession, senderSession->decrypt(ciphertext), eventId,
+                               timestamp);
+    }
+
+    //! \brief Decrypt a single event
+    //!
+    //! This neither flushes the replay protection records nor trims the loaded sessions,
+    //! leaving it to the caller, so that it can be done once for a batch of events.
+    RoomEventPtr decryptMessage(const EncryptedEvent& encryptedEvent)
+    {
+        if (const auto algorithm = encryptedEvent.algorithm(); !isSupportedAlgorithm(algorithm)) {
+            qWarning(E2EE) << "Algorithm" << algorithm << "of encrypted event"
+                           << encryptedEvent.id() << "is not supported";
+            return {};
+        }
+        const auto decrypted = groupSessionDecryptMessage(
+            encryptedEvent.ciphertext(), encryptedEvent.sessionId().toLatin1(),
+            encryptedEvent.id(), encryptedEvent.originTimestamp(), encryptedEvent.senderId());
+        if (decrypted.isEmpty())
+            return {};
+        return makeDecryptedEvent(encryptedEvent, decrypted);
+    }
+
+    //! Make an event from the \p plaintext of \p encryptedEvent, if it belongs to this room
+    RoomEventPtr makeDecryptedEvent(const EncryptedEvent& encryptedEvent,
+                                    const QString& plaintext) const
+    {
+        auto decryptedEvent = encryptedEvent.createDecrypted(plaintext);
+        if (decryptedEvent->roomId() == id) {
+            return decryptedEvent;
+        }
+        qWarning(E2EE) << "Decrypted event" << encryptedEvent.id()
+                       << "not for this room; discarding";
+        return {};
+    }
+
     bool shouldRotateMegolmSession() const
     {
         const auto* encryptionConfig = currentState.get<EncryptionEvent>();
@@ -427,6 +615,7 @@ public:
         currentOutboundMegolmSession.emplace();
         connection->database()->saveCurrentOutboundMegolmSession(
             id, *currentOutboundMegolmSession);
+        outboundMegolmSessionDirty = false;
 
         addInboundGroupSession(currentOutboundMegolmSession->sessionId(),
                                currentOutboundMegolmSession->sessionKey(),
@@ -435,15 +624,87 @@ public:
                                connection->edKeyForUserDevice(connection->userId(), connection->deviceId()).toLatin1());
     }
 
-    QMultiHash<QString, QString> getDevicesWithoutKey() const
+    //! \brief Note that the outbound session is about to move ahead of its stored state
+    //!
+    //! Instead of saving the session after each message, the stored state is removed before
+    //! the first message of a burst, and the session is saved once no messages have been sent
+    //! for a second. If the application stops in between, a new session is made on the next
+    //! start; the stale state, if loaded, would reuse message indices.
+    void markOutboundMegolmSessionDirty()
+    {
+        outboundMegolmSessionSaveTimer.start();
+        if (std::exchange(outboundMegolmSessionDirty, true))
+            return;
+        connection->database()->removeOutboundMegolmSessions(id);
+    }
+
+    void saveOutboundMegolmSession()
+    {
+        if (!std::exchange(outboundMegolmSessionDirty, false) || !currentOutboundMegolmSession)
+            return;
+        connection->database()->saveCurrentOutboundMegolmSession(id,
+                                                                 *currentOutboundMegolmSession);
+    }
+
+    QMultiHash<QString, QString> getDevicesWithoutKey()
+    {
+        loadDeferredState(); // The key must go to all members, not only the heroes
+        if (const auto sessionId = currentOutboundMegolmSession->sessionId();
+            sessionId != devicesWithKeySessionId) {
+            devicesWithKey = connection->database()->devicesWithKey(id, sessionId);
+            devicesWithKeySessionId = sessionId;
+            devicesWithKeyInFlight.clear();
+            devicesWithoutKey.reset();
+        }
+        if (!devicesWithoutKey) {
+            devicesWithoutKey.emplace();
+            for (const auto& user : membersJoined + membersInvited) {
+                const auto userDevicesWithKey = devicesWithKey.value(user);
+                const auto userDevicesInFlight = devicesWithKeyInFlight.value(user);
+                for (const auto& deviceId : connection->devicesForUser(user))
+                    if (!userDevicesWithKey.contains(deviceId)
+                        && !userDevicesInFlight.contains(deviceId))
+                        devicesWithoutKey->insert(user, deviceId);
+            }
+        }
+        return *devicesWithoutKey;
+    }
+
+    //! Move \p devices from devicesWithoutKey to devicesWithKeyInFlight
+    void onSendingKey(const QMultiHash<QString, QString>& devices)
     {
-        QMultiHash<QString, QString> devices;
-        for (const auto& user : memberNameMap.values() + membersInvited)
-            for (const auto& deviceId : connection->devicesForUser(user))
-                devices.insert(user, deviceId);
+        for (const auto& [userId, deviceId] : devices.asKeyValueRange()) {
+            devicesWithKeyInFlight[userId].insert(deviceId);
+            if (devicesWithoutKey)
+                devicesWithoutKey->remove(userId, deviceId);
+        }
+    }
 
-        return connection->database()->devicesWithoutKey(
-            id, devices, currentOutboundMegolmSession->sessionId());
+    void onDevicesFailedKey(const QByteArray& sessionId,
+                            const QMultiHash<QString, QString>& devices)
+    {
+        if (sessionId != devicesWithKeySessionId)
+            return; // The session is not current any more
+        for (const auto& [userId, deviceId] : devices.asKeyValueRange())
+            if (const auto it = devicesWithKeyInFlight.find(userId);
+                it != devicesWithKeyInFlight.end() && it->remove(deviceId) && devicesWithoutKey
+                && !devicesWithoutKey->contains(userId, deviceId))
+                devicesWithoutKey->insert(userId, deviceId); // Try again with the next message
+    }
+
+    void onDevicesReceivedKey(const QByteArray& sessionId,
+                              const QMultiHash<QString, QString>& devices)
+    {
+        if (sessionId != devicesWithKeySessionId)
+            return; // The next getDevicesWithoutKey() call loads it all from the database
+        for (const auto& [userId, deviceId] : devices.asKeyValueRange()) {
+            devicesWithKey[userId].insert(deviceId);
+            if (const auto it = devicesWithKeyInFlight.find(userId);
+                it != devicesWithKeyInFlight.end())
+                it->remove(deviceId);
+            if (devicesWithoutKey)
+                devicesWithoutKey->remove(userId, deviceId);
+        }
     }
 
 private:
@@ -463,14 +724,20 @@ Room::Room(Connection* connection, QString id, JoinState initialJoinState)
     d->q = this;
     d->displayname = d->calculateDisplayname(); // Set initial "Empty room" name
     if (connection->encryptionEnabled()) {
+        d->outboundMegolmSessionSaveTimer.setSingleShot(true);
+        d->outboundMegolmSessionSaveTimer.setInterval(std::chrono::seconds(1));
+        connect(&d->outboundMegolmSessionSaveTimer, &QTimer::timeout, this,
+                [this] { d->saveOutboundMegolmSession(); });
         connect(this, &Room::encryption, this,
                 [this, connection] { connection->encryptionUpdate(this); });
+        connect(connection, &Connection::finishedQueryingKeys, this,
+                [this] { d->devicesWithoutKey.reset(); });
         connect(this, &Room::memberListChanged, this, [this, connection] {
+            d->devicesWithoutKey.reset();
             if(usesEncryption()) {
                 connection->encryptionUpdate(this, d->membersInvited);
             }
         });
-        d->groupSessions = connection->loadRoomMegolmSessions(this);
         d->currentOutboundMegolmSession =
             connection->database()->loadCurrentOutboundMegolmSession(id);
         if (d->currentOutboundMegolmSession
@@ -494,11 +761,25 @@ Room::Room(Connection* connection, QString id, JoinState initialJoinState)
 
 Room::~Room() { delete d; }
 
+void Room::saveOutboundMegolmSession() { d->saveOutboundMegolmSession(); }
+
+void Room::onDevicesReceivedKey(const QByteArray& sessionId,
+                                const QMultiHash<QString, QString>& devices)
+{
+    d->onDevicesReceivedKey(sessionId, devices);
+}
+
+void Room::onDevicesFailedKey(const QByteArray& sessionId,
+                              const QMultiHash<QString, QString>& devices)
+{
+    d->onDevicesFailedKey(sessionId, devices);
+}
+
 const QString& Room::id() const { return d->id; }
 
 QString Room::version() const
 {
-    const auto v = currentState().query(&RoomCreateEvent::version);
+    const auto v = d->currentState.query(&RoomCreateEvent::version);
     return v && !v->isEmpty() ? *v : QStringLiteral("1");
 }
 
@@ -510,7 +791,7 @@ bool Room::isUnstable() const
 
 QString Room::predecessorId() const
 {
-    if (const auto* evt = currentState().get<RoomCreateEvent>())
+    if (const auto* evt = d->currentState.get<RoomCreateEvent>())
         return evt->predecessor().roomId;
 
     return {};
@@ -528,7 +809,7 @@ Room* Room::predecessor(JoinStates statesFilter) const
 
 QString Room::successorId() const
 {
-    return currentState().queryOr(&RoomTombstoneEvent::successorRoomId,
+    return d->currentState.queryOr(&RoomTombstoneEvent::successorRoomId,
                                   QString());
 }
 
@@ -561,12 +842,12 @@ bool Room::allHistoryLoaded() const
 
 QString Room::name() const
 {
-    return currentState().content<RoomNameEvent>().value;
+    return d->currentState.content<RoomNameEvent>().value;
 }
 
 QStringList Room::aliases() const
 {
-    if (const auto* evt = currentState().get<RoomCanonicalAliasEvent>()) {
+    if (const auto* evt = d->currentState.get<RoomCanonicalAliasEvent>()) {
         auto result = evt->altAliases();
         if (!evt->alias().isEmpty())
             result << evt->alias();
@@ -577,12 +858,12 @@ QStringList Room::aliases() const
 
 QStringList Room::altAliases() const
 {
-    return currentState().content<RoomCanonicalAliasEvent>().altAliases;
+    return d->currentState.content<RoomCanonicalAliasEvent>().altAliases;
 }
 
 QString Room::canonicalAlias() const
 {
-    return currentState().content<RoomCanonicalAliasEvent>().canonicalAlias;
+    return d->currentState.content<RoomCanonicalAliasEvent>().canonicalAlias;
 }
 
 QString Room::displayName() const { return d->displayname; }
@@ -610,7 +891,7 @@ void Room::refreshDisplayName() { d->updateDisplayname(); }
 
 QString Room::topic() const
 {
-    return currentState().content<RoomTopicEvent>().value;
+    return d->currentState.content<RoomTopicEvent>().value;
 }
 
 QString Room::avatarMediaId() const { return d->avatar.mediaId(); }
@@ -643,21 +924,15 @@ RoomMember Room::member(const QString& userId) const
     if (userId.isEmpty()) {
         return {};
     }
-    return RoomMember(this, currentState().get<RoomMemberEvent>(userId));
+    return RoomMember(this, d->currentState.get<RoomMemberEvent>(userId));
 }
 
 QList<RoomMember> Room::joinedMembers() const
 {
     QList<RoomMember> joinedMembers;
-    joinedMembers.reserve(joinedCount());
-
-    const auto memberEvents = currentState().eventsOfType(RoomMemberEvent::TypeId);
-    for (const auto event : memberEvents) {
-        if (const auto memberEvent = eventCast<const RoomMemberEvent>(event);
-            memberEvent->membership() == Membership::Join) {
-            joinedMembers.append(RoomMember(this, memberEvent));
-        }
-    }
+    joinedMembers.reserve(d->membersJoined.size());
+    for (const auto& memberId : d->membersJoined)
+        joinedMembers.append(member(memberId));
     return joinedMembers;
 }
 
@@ -665,7 +940,7 @@ QList<RoomMember> Room::members() const {
     QList<RoomMember> members;
     members.reserve(totalMemberCount());
 
-    const auto memberEvents = currentState().eventsOfType(RoomMemberEvent::TypeId);
+    const auto memberEvents = d->currentState.eventsOfType(RoomMemberEvent::TypeId);
     for (const auto event : memberEvents) {
         if (const auto memberEvent = eventCast<const RoomMemberEvent>(event)) {
             members.append(RoomMember(this, memberEvent));
@@ -693,17 +968,17 @@ QList<RoomMember> Room::otherMembersTyping() const
 
 QStringList Room::joinedMemberIds() const
 {
-    QStringList ids;
-    ids.reserve(joinedCount());
+    return d->membersJoined;
+}
 
-    const auto memberEvents = currentState().eventsOfType(RoomMemberEvent::TypeId);
-    for (const auto event : memberEvents) {
-        if (const auto memberEvent = eventCast<const RoomMemberEvent>(event);
-            memberEvent->membership() == Membership::Join) {
-            ids.append(memberEvent->userId());
-        }
-    }
-    return ids;
+QStringList Room::invitedMemberIds() const
+{
+    return d->membersInvited;
+}
+
+QStringList Room::leftMemberIds() const
+{
+    return d->membersLeft;
 }
 
 QStringList Room::memberIds() const
@@ -711,7 +986,7 @@ QStringList Room::memberIds() const
     QStringList ids;
     ids.reserve(totalMemberCount());
 
-    const auto memberEvents = currentState().eventsOfType(RoomMemberEvent::TypeId);
+    const auto memberEvents = d->currentState.eventsOfType(RoomMemberEvent::TypeId);
     for (const auto event : memberEvents) {
         if (const auto memberEvent = eventCast<const RoomMemberEvent>(event)) {
             ids.append(memberEvent->userId());
@@ -935,6 +1210,44 @@ Room::Changes Room::Private::updateStats(const rev_iter_t& from,
     return changes;
 }
 
+void Room::Private::updateStatsIndex(const TimelineItem& ti)
+{
+    statsIndex.set(ti.index(),
+                   { q->isEventNotable(ti),
+                     notifications.value(ti->id()).type == Notification::Highlight });
+}
+
+Room::Changes Room::Private::reevaluateStats(const TimelineItem& ti)
+{
+    const auto oldCounts = statsIndex.count(ti.index(), ti.index());
+    updateStatsIndex(ti);
+    const auto delta = statsIndex.count(ti.index(), ti.index()) - oldCounts;
+    if (delta == _impl::EventStatsIndex::Counts{})
+        return Change::None;
+
+    // Statistics estimated so far are recalculated entirely once their marker moves
+    const auto applyDelta = [&ti, &delta, this](EventStats& stats, const rev_iter_t& marker) {
+        if (marker == q->historyEdge() || ti.index() <= marker->index())
+            return false;
+        stats.notableCount += delta.notable;
+        stats.highlightCount += delta.highlight;
+        return true;
+    };
+    Changes changes = Change::None;
+    if (applyDelta(partiallyReadStats, q->fullyReadMarker()))
+        changes |= Change::PartiallyReadStats;
+    if (applyDelta(unreadStats, q->localReadReceiptMarker()))
+        changes |= Change::UnreadStats;
+    return changes;
+}
+
+EventStats Room::countEvents(TimelineItem::index_t first, TimelineItem::index_t last) const
+{
+    Q_ASSERT(isValidIndex(first) && isValidIndex(last));
+    const auto counts = d->statsIndex.count(first, last);
+    return { counts.notable, counts.highlight, false };
+}
+
 Room::Changes Room::Private::setFullyReadMarker(const QString& eventId)
 {
     if (fullyReadUntilEventId == eventId)
@@ -1046,7 +1359,9 @@ Notification Room::notificationFor(const TimelineItem &ti) const
 
 Notification Room::checkForNotifications(const TimelineItem &ti)
 {
-    return { Notification::None };
+    if (ti->senderId() == localMember().id())
+        return { Notification::None };
+    return connection()->pushRuleEvaluator().evaluate(this, *ti);
 }
 
 int countFromStats(const EventStats& s)
@@ -1118,18 +1433,18 @@ const Room::RelatedEvents Room::relatedEvents(
 
 const RoomCreateEvent* Room::creation() const
 {
-    return currentState().get<RoomCreateEvent>();
+    return d->currentState.get<RoomCreateEvent>();
 }
 
 const RoomTombstoneEvent* Room::tombstone() const
 {
-    return currentState().get<RoomTombstoneEvent>();
+    return d->currentState.get<RoomTombstoneEvent>();
 }
 
 void Room::Private::getAllMembers()
 {
     // If already loaded or already loading, there's nothing to do here.
-    if (q->joinedCount() <= currentState.eventsOfType(RoomMemberEvent::TypeId).size() || isJobPending(allMembersJob))
+    if (q->joinedCount() <= currentState.eventCountOfType(RoomMemberEvent::TypeId) || isJobPending(allMembersJob))
         return;
 
     allMembersJob = connection->callApi<GetMembersByRoomJob>(
@@ -1159,8 +1474,11 @@ void Room::setDisplayed(bool displayed)
 
     d->displayed = displayed;
     emit displayedChanged(displayed);
-    if (displayed)
+    if (displayed) {
+        d->loadDeferredState();
         d->getAllMembers();
+    } else
+        d->evictOldEvents(); // The history loaded for display is not needed any more
 }
 
 QString Room::firstDisplayedEventId() const { return d->firstDisplayedEventId; }
@@ -1512,7 +1830,7 @@ int Room::timelineSize() const { return int(d->timeline.size()); }
 
 bool Room::usesEncryption() const
 {
-    return !currentState()
+    return !d->currentState
                 .queryOr(&EncryptionEvent::algorithm, QString())
                 .isEmpty();
 }
@@ -1540,28 +1858,11 @@ int Room::memberEffectivePowerLevel(const QString& memberId) const
 
 RoomEventPtr Room::decryptMessage(const EncryptedEvent& encryptedEvent)
 {
-    if (const auto algorithm = encryptedEvent.algorithm();
-        !isSupportedAlgorithm(algorithm)) //
-    {
-        qWarning(E2EE) << "Algorithm" << algorithm << "of encrypted event"
-                       << encryptedEvent.id() << "is not supported";
-        return {};
-    }
-    QString decrypted = d->groupSessionDecryptMessage(
-        encryptedEvent.ciphertext(), encryptedEvent.sessionId().toLatin1(),
-        encryptedEvent.id(), encryptedEvent.originTimestamp(),
-        encryptedEvent.senderId());
-    if (decrypted.isEmpty()) {
-        // qCWarning(E2EE) << "Encrypted message is empty";
-        return {};
-    }
-    auto decryptedEvent = encryptedEvent.createDecrypted(decrypted);
-    if (decryptedEvent->roomId() == id()) {
-        return decryptedEvent;
-    }
-    qWarning(E2EE) << "Decrypted event" << encryptedEvent.id()
-                   << "not for this room; discarding";
-    return {};
+    auto decrypted = d->decryptMessage(encryptedEvent);
+    if (auto* db = connection()->database())
+        db->flushGroupSessionIndexRecords();
+    d->trimGroupSessions();
+    return decrypted;
 }
 
 void Room::handleRoomKeyEvent(const RoomKeyEvent& roomKeyEvent,
@@ -1577,25 +1878,34 @@ void Room::handleRoomKeyEvent(const RoomKeyEvent& roomKeyEvent,
     if (d->addInboundGroupSession(roomKeyEvent.sessionId().toLatin1(),
                                   roomKeyEvent.sessionKey(), senderId,
                                   olmSessionId, senderKey, senderEdKey)) {
-        qCWarning(E2EE) << "added new inboundGroupSession:"
-                        << d->groupSessions.size();
+        qCWarning(E2EE) << "added new inboundGroupSession:" << roomKeyEvent.sessionId();
         const auto undecryptedEvents =
             d->undecryptedEvents[roomKeyEvent.sessionId()];
+        Changes changes = Change::None;
         for (const auto& eventId : undecryptedEvents) {
             const auto pIdx = d->eventsIndex.constFind(eventId);
             if (pIdx == d->eventsIndex.cend())
                 continue;
             auto& ti = d->timeline[Timeline::size_type(*pIdx - minTimelineIndex())];
             if (auto encryptedEvent = ti.viewAs<EncryptedEvent>()) {
-                if (auto decrypted = decryptMessage(*encryptedEvent)) {
+                if (auto decrypted = d->decryptMessage(*encryptedEvent)) {
                     auto&& oldEvent = eventCast<EncryptedEvent>(
                         ti.replaceEvent(std::move(decrypted)));
                     ti->setOriginalEvent(std::move(oldEvent));
+                    // Push rules could not see the content until now
+                    if (auto n = checkForNotifications(ti); n.type != Notification::None)
+                        d->notifications.insert(eventId, n);
+                    else
+                        d->notifications.remove(eventId);
+                    changes |= d->reevaluateStats(ti);
                     emit replacedEvent(ti.event(), ti->originalEvent());
                     d->undecryptedEvents[roomKeyEvent.sessionId()] -= eventId;
                 }
             }
         }
+        connection()->database()->flushGroupSessionIndexRecords();
+        d->trimGroupSessions();
+        d->postprocessChanges(changes);
     }
 }
 
@@ -1702,6 +2012,77 @@ void Room::Private::removeMemberFromMap(const QString& memberId)
     }
 }
 
+QStringList& Room::Private::memberIdsList(Membership membership)
+{
+    switch (membership) {
+    case Membership::Join:
+        return membersJoined;
+    case Membership::Invite:
+        return membersInvited;
+    default:
+        return membersLeft;
+    }
+}
+
+void Room::Private::addMemberId(Membership membership, const QString& memberId)
+{
+    if (resettingMemberLists)
+        return;
+
+    auto& ids = memberIdsList(membership);
+    const auto it = std::lower_bound(ids.cbegin(), ids.cend(), memberId);
+    if (it != ids.cend() && *it == memberId)
+        return;
+    const auto index = int(it - ids.cbegin());
+    emit q->aboutToAddMemberId(membership, index);
+    ids.insert(index, memberId);
+    emit q->addedMemberId(membership, index);
+}
+
+void Room::Private::removeMemberId(Membership membership, const QString& memberId)
+{
+    if (resettingMemberLists)
+        return;
+
+    auto& ids = memberIdsList(membership);
+    const auto it = std::lower_bound(ids.cbegin(), ids.cend(), memberId);
+    if (it == ids.cend() || *it != memberId)
+        return;
+    const auto index = int(it - ids.cbegin());
+    emit q->aboutToRemoveMemberId(membership, index);
+    ids.removeAt(index);
+    emit q->removedMemberId(membership, index);
+}
+
+void Room::Private::resetMemberLists()
+{
+    membersJoined.clear();
+    membersInvited.clear();
+    membersLeft.clear();
+    for (const auto* evt : currentState.eventsOfType(RoomMemberEvent::TypeId)) {
+        const auto& memberEvt = static_cast<const RoomMemberEvent&>(*evt);
+        switch (memberEvt.membership()) {
+        case Membership::Join:
+            membersJoined.append(memberEvt.userId());
+            break;
+        case Membership::Invite:
+            membersInvited.append(memberEvt.userId());
+            break;
+        case Membership::Knock:
+        case Membership::Ban:
+        case Membership::Leave:
+            membersLeft.append(memberEvt.userId());
+            break;
+        case Membership::Undefined:
+            break;
+        }
+    }
+    for (auto* ids : { &membersJoined, &membersInvited, &membersLeft })
+        std::sort(ids->begin(), ids->end());
+    resettingMemberLists = false;
+    emit q->memberListsReset();
+}
+
 inline auto makeErrorStr(const Event& e, QByteArray msg)
 {
     return msg.append("; event dump follows:\n")
@@ -1749,6 +2130,7 @@ Room::Private::moveEventsToTimeline(RoomEventsRange events,
 
         if (auto n = q->checkForNotifications(ti); n.type != Notification::None)
             notifications.insert(eId, n);
+        updateStatsIndex(ti);
         Q_ASSERT(q->findInTimeline(eId)->event()->id() == eId);
     }
     const auto insertedSize = (index - baseIndex) * placement;
@@ -1829,6 +2211,10 @@ Room::Changes Room::Private::updateStatsFromSyncData(const SyncRoomData& data,
 
 void Room::updateData(SyncRoomData&& data, bool fromCache)
 {
+    // Live updates have to be applied on top of the full cached state, not its preview
+    if (!fromCache)
+        d->loadDeferredState();
+
     qCDebug(MAIN) << "--- Updating room" << id() << "/" << objectName();
     bool firstUpdate = d->baseState.empty();
 
@@ -1836,6 +2222,18 @@ void Room::updateData(SyncRoomData&& data, bool fromCache)
         *d->prevBatch = data.timelinePrevBatch;
     setJoinState(data.joinState);
 
+    // Events cached in the previous session can't be joined with events after a gap
+    if (!fromCache && data.timelineLimited && !d->cachedFrontSeq && d->timeline.empty())
+        if (auto* store = connection()->timelineStore()) {
+            store->enqueueClearRoom(id());
+            d->cachedFrontSeq = 0; // Don't wait for the store to tell what's known already
+            d->hasCachedHistory = false;
+        }
+
+    if (connection()->timelineSizeLimit() > 0 && !data.timeline.empty()
+        && !data.timelinePrevBatch.isEmpty())
+        d->batchPrevTokens.insert(data.timeline.front()->id(), data.timelinePrevBatch);
+
     Changes roomChanges {};
     // The order of calculation is important - don't merge the lines!
     roomChanges |= d->updateStateFrom(std::move(data.state));
@@ -1864,9 +2262,36 @@ void Room::updateData(SyncRoomData&& data, bool fromCache)
     }
     if (firstUpdate)
         emit baseStateLoaded();
+    d->evictOldEvents();
+    if (!data.stateCacheFile.isEmpty())
+        d->deferredStateFile = std::move(data.stateCacheFile);
     qCDebug(MAIN) << "--- Finished updating room" << id() << "/" << objectName();
 }
 
+void Room::Private::loadDeferredState()
+{
+    if (deferredStateFile.isEmpty())
+        return;
+
+    QElapsedTimer et;
+    et.start();
+    const auto fileName = std::exchange(deferredStateFile, QString());
+    const auto json = SyncData::loadCacheFile(fileName);
+    if (json.isEmpty()) {
+        qCCritical(MAIN) << "Couldn't load the state of" << q->objectName() << "from" << fileName
+                         << "- only the room preview will be available";
+        return;
+    }
+    SyncRoomData data{ id, joinState, json };
+    // The preview events are already in the state; don't process them again
+    std::erase_if(data.state, [this](const StateEventPtr& evt) {
+        const auto* curEvt = currentState.get(evt->matrixType(), evt->stateKey());
+        return curEvt && curEvt->id() == evt->id();
+    });
+    q->updateData(std::move(data), true);
+    qCDebug(PROFILER) << "*** Deferred state of" << q->objectName() << "loaded in" << et;
+}
+
 void Room::Private::postprocessChanges(Changes changes, bool saveState)
 {
     if (!changes)
@@ -1941,16 +2366,17 @@ const PendingEventItem& Room::Private::doSendEvent(PendingEvents::iterator event
             createMegolmSession();
         }
 
-        // Send the session to other people
-        connection->sendSessionKeyToDevices(id, *currentOutboundMegolmSession,
-                                            getDevicesWithoutKey());
+        // Send the session to other people; until it's delivered (or fails to), the next
+        // messages won't send it to the same devices again
+        const auto recipients = getDevicesWithoutKey();
+        onSendingKey(recipients);
+        connection->sendSessionKeyToDevices(id, *currentOutboundMegolmSession, recipients);
 
+        markOutboundMegolmSessionDirty();
         const auto encrypted = currentOutboundMegolmSession->encrypt(
             QJsonDocument(eventItem->fullJson()).toJson());
         currentOutboundMegolmSession->setMessageCount(
             currentOutboundMegolmSession->messageCount() + 1);
-        connection->database()->saveCurrentOutboundMegolmSession(
-            id, *currentOutboundMegolmSession);
         encryptedEvent = makeEvent<EncryptedEvent>(
             encrypted, connection->olmAccount()->identityKeys().curve25519,
             connection->deviceId(), QString::fromLatin1(currentOutboundMegolmSession->sessionId()));
@@ -2309,6 +2735,9 @@ JobHandle<GetRoomEventsJob> Room::getPreviousContent(int limit, const QString& f
 
 JobHandle<GetRoomEventsJob> Room::Private::getPreviousContent(int limit, const QString& filter)
 {
+    if (filter.isEmpty() && loadCachedHistory(limit))
+        return {}; // No network request needed
+
     if (!prevBatch)
         return {}; // No further history = cancelled future
 
@@ -2330,7 +2759,10 @@ JobHandle<GetRoomEventsJob> Room::Private::getPreviousContent(int limit, const Q
             prevBatch.reset();
         }
 
-        auto [changes, from] = addHistoricalMessageEvents(eventsHistoryJob->chunk());
+        auto chunk = eventsHistoryJob->chunk();
+        if (prevBatch && connection->timelineSizeLimit() > 0 && !chunk.empty())
+            batchPrevTokens.insert(chunk.back()->id(), *prevBatch);
+        auto [changes, from] = addHistoricalMessageEvents(std::move(chunk));
         // The following condition will only trigger once, next time getPreviousContent()
         // will return without spawning GetRoomEventsJob
         if (!prevBatch)
@@ -2344,6 +2776,104 @@ JobHandle<GetRoomEventsJob> Room::Private::getPreviousContent(int limit, const Q
     return eventsHistoryJob;
 }
 
+void Room::Private::initCachedFrontSeq(TimelineStore& store)
+{
+    if (cachedFrontSeq)
+        return;
+    // Everything stored so far precedes the events received in this session; this is called
+    // for each room on the first save, so avoid waiting for the writes queued before
+    cachedFrontSeq = store.initialEndSeq(id);
+    hasCachedHistory = hasCachedHistory && *cachedFrontSeq > 0;
+}
+
+bool Room::Private::loadCachedHistory(int limit)
+{
+    auto* const store = connection->timelineStore();
+    if (!store) {
+        // Whatever gets cached later won't be older than the history loaded from the server
+        hasCachedHistory = false;
+        return false;
+    }
+    if (!hasCachedHistory || limit <= 0)
+        return false;
+
+    QElapsedTimer et;
+    et.start();
+    initCachedFrontSeq(*store);
+    bool loaded = false;
+    while (!loaded && hasCachedHistory) {
+        auto cachedEvents = store->loadEvents(id, *cachedFrontSeq, limit);
+        hasCachedHistory = cachedEvents.size() == size_t(limit);
+        if (cachedEvents.empty())
+            break;
+
+        *cachedFrontSeq = cachedEvents.back().first;
+        RoomEvents events;
+        events.reserve(cachedEvents.size());
+        for (const auto& cachedEvent : cachedEvents)
+            events.push_back(loadEvent<RoomEvent>(cachedEvent.second));
+        auto [changes, from] = addHistoricalMessageEvents(std::move(events));
+        if (from == historyEdge())
+            continue; // All of them are already in the timeline, try the next batch
+        changes |= updateStats(from, historyEdge());
+        if (changes > 0)
+            postprocessChanges(changes, false);
+        loaded = true;
+    }
+    if (!hasCachedHistory) {
+        // Further history comes from the server, starting right before the oldest cached event
+        if (const auto cachedPrevBatch = store->prevBatch(id); !cachedPrevBatch) {
+            if (prevBatch) {
+                prevBatch.reset();
+                emit q->allHistoryLoadedChanged();
+            }
+        } else if (prevBatch && !cachedPrevBatch->isEmpty())
+            *prevBatch = *cachedPrevBatch;
+    }
+    if (loaded && et.nsecsElapsed() >= ProfilerMinNsecs)
+        qCDebug(PROFILER) << "Loaded cached history of" << q->objectName() << "in" << et;
+    return loaded;
+}
+
+std::function<void(TimelineStore&)> Room::prepareCachedTimeline(TimelineStore& store,
+                                                                int maxEvents) const
+{
+    return d->prepareCachedTimeline(store, maxEvents);
+}
+
+std::function<void(TimelineStore&)> Room::Private::prepareCachedTimeline(TimelineStore& store,
+                                                                         int maxEvents)
+{
+    if (timeline.empty() || maxEvents <= 0)
+        return {};
+
+    const auto savedCount = std::min(timeline.size(), size_t(maxEvents));
+    QJsonArray eventsJson;
+    for (auto it = timeline.cend() - ptrdiff_t(savedCount); it != timeline.cend(); ++it) {
+        const auto* evt = it->event();
+        // Keep encrypted events encrypted on disk; they are decrypted again once loaded
+        eventsJson.append(evt->originalEvent() ? evt->originalEvent()->fullJson()
+                                               : evt->fullJson());
+    }
+
+    initCachedFrontSeq(store);
+    // Stored events not loaded to the timeline yet would be trimmed away anyway
+    if (timeline.size() >= size_t(maxEvents))
+        hasCachedHistory = false;
+    if (!hasCachedHistory)
+        cachedFrontSeq = 0; // Replace whatever has been stored
+
+    return [roomId = id, fromSeq = *cachedFrontSeq, eventsJson = std::move(eventsJson), maxEvents,
+            allSaved = savedCount == timeline.size(), replacesAll = !hasCachedHistory,
+            prevBatch = prevBatch](TimelineStore& s) {
+        const auto trimmed = s.saveEvents(roomId, fromSeq, eventsJson, maxEvents);
+        if (trimmed || !allSaved)
+            s.setPrevBatch(roomId, QString()); // The token for the oldest stored event is unknown
+        else if (replacesAll)
+            s.setPrevBatch(roomId, prevBatch);
+    };
+}
+
 void Room::inviteToRoom(const QString& memberId)
 {
     connection()->callApi<InviteUserJob>(id(), memberId);
@@ -2381,19 +2911,22 @@ void Room::uploadFile(const QString& id, const QUrl& localFilename,
 {
     // This is required because toLocalFile doesn't work on android and toString doesn't work on the desktop
     auto fileName = localFilename.isLocalFile() ? localFilename.toLocalFile() : localFilename.toString();
-    FileSourceInfo fileMetadata;
-    QTemporaryFile tempFile;
+    JobHandle<UploadContentJob> job;
+    QPointer<EncryptingDevice> encryptor;
     if (usesEncryption()) {
-        tempFile.open();
-        QFile file(fileName);
-        file.open(QFile::ReadOnly);
-        QByteArray data;
-        std::tie(fileMetadata, data) = encryptFile(file.readAll());
-        tempFile.write(data);
-        tempFile.close();
-        fileName = QFileInfo(tempFile).absoluteFilePath();
-    }
-    auto job = connection()->uploadFile(fileName, overrideContentType);
+        // The file is encrypted on the fly as it's uploaded; the metadata, including the hash
+        // of the ciphertext, is only complete once the whole file has been read
+        encryptor = new EncryptingDevice(new QFile(fileName));
+        if (encryptor->open(QIODevice::ReadOnly)) {
+            // Neither the real name nor the real type should leak to the server
+            job = connection()->uploadContent(encryptor, {}, "application/octet-stream"_ls);
+        } else {
+            qCWarning(MAIN) << "Couldn't open" << fileName
+                            << "for encryption:" << encryptor->errorString();
+            delete encryptor.data();
+        }
+    } else
+        job = connection()->uploadFile(fileName, overrideContentType);
     if (isJobPending(job)) {
         d->fileTransfers[id] = { job, fileName, true };
         connect(job, &BaseJob::uploadProgress, this,
@@ -2402,8 +2935,17 @@ void Room::uploadFile(const QString& id, const QUrl& localFilename,
                     emit fileTransferProgress(id, sent, total);
                 });
         connect(job, &BaseJob::success, this,
-                [this, id, localFilename, job, fileMetadata]() mutable {
-                    // The lambda is mutable to change encryptedFileMetadata
+                [this, id, localFilename, job, encryptor] {
+                    FileSourceInfo fileMetadata;
+                    if (encryptor) {
+                        // The job owns the device, so it's alive as long as the job is
+                        auto encryptedFileMetadata = encryptor->metadata();
+                        if (!encryptedFileMetadata) {
+                            d->failedTransfer(id, tr("Couldn't encrypt the file"));
+                            return;
+                        }
+                        fileMetadata = *std::move(encryptedFileMetadata);
+                    }
                     d->fileTransfers[id].status = FileTransferInfo::Completed;
                     setUrlInSourceInfo(fileMetadata, QUrl(job->contentUri()));
                     emit fileTransferCompleted(id, localFilename, fileMetadata);
@@ -2498,19 +3040,14 @@ void Room::Private::dropExtraneousEvents(RoomEvents& events) const
     if (events.empty())
         return;
 
-    // Multiple-remove (by different criteria), single-erase
-    // 1. Check for duplicates against the timeline and for events from ignored
-    //    users
-    auto newEnd =
-        remove_if(events.begin(), events.end(), [this](const RoomEventPtr& e) {
-            return eventsIndex.contains(e->id())
-                   || connection->isIgnored(e->senderId());
-        });
-
-    // 2. Check for duplicates within the batch if there are still events.
-    for (auto eIt = events.begin(); distance(eIt, newEnd) > 1; ++eIt)
-        newEnd = remove_if(eIt + 1, newEnd, [eIt](const RoomEventPtr& e) {
-            return e->id() == (*eIt)->id();
+    // Single pass over the batch, dropping duplicates against the timeline, events from ignored
+    // users and duplicates within the batch (the first occurrence is kept)
+    std::unordered_set<QString> batchIds;
+    batchIds.reserve(events.size());
+    const auto newEnd =
+        remove_if(events.begin(), events.end(), [this, &batchIds](const RoomEventPtr& e) {
+            return eventsIndex.contains(e->id()) || connection->isIgnored(e->senderId())
+                   || !batchIds.insert(e->id()).second;
         });
 
     if (newEnd == events.end())
@@ -2530,23 +3067,89 @@ void Room::Private::decryptIncomingEvents(RoomEvents& events)
 
     QElapsedTimer et;
     et.start();
-    size_t totalDecrypted = 0;
-    for (auto& eptr : events) {
+    // Decrypting is the expensive part; it is done for each session in a thread pool task,
+    // events of the same session being decrypted in their order. Replay checks, that use
+    // the database, and making new events happen in this thread, in the order of events.
+    struct Decryption {
+        QOlmInboundGroupSession* session = nullptr;
+        std::optional<QOlmExpected<std::pair<QByteArray, uint32_t>>> result{};
+    };
+    std::vector<Decryption> decryptions(events.size());
+    std::unordered_map<QByteArray, std::vector<size_t>> positionsBySession;
+    for (size_t pos = 0; pos < events.size(); ++pos) {
+        const auto& eptr = events[pos];
         if (eptr->isRedacted())
             continue;
-        if (const auto& eeptr = eventCast<EncryptedEvent>(eptr)) {
-            if (auto decrypted = q->decryptMessage(*eeptr)) {
-                ++totalDecrypted;
-                auto&& oldEvent = eventCast<EncryptedEvent>(
-                        std::exchange(eptr, std::move(decrypted)));
-                eptr->setOriginalEvent(std::move(oldEvent));
-            } else
-                undecryptedEvents[eeptr->sessionId()] += eeptr->id();
+        const auto* eeptr = eventCast<EncryptedEvent>(eptr);
+        if (!eeptr)
+            continue;
+        if (const auto algorithm = eeptr->algorithm(); !isSupportedAlgorithm(algorithm)) {
+            qWarning(E2EE) << "Algorithm" << algorithm << "of encrypted event" << eeptr->id()
+                           << "is not supported";
+            undecryptedEvents[eeptr->sessionId()] += eeptr->id();
+            continue;
         }
+        const auto sessionId = eeptr->sessionId().toLatin1();
+        decryptions[pos].session = inboundSessionFor(sessionId, eeptr->senderId());
+        if (decryptions[pos].session)
+            positionsBySession[sessionId].push_back(pos);
+        else
+            undecryptedEvents[eeptr->sessionId()] += eeptr->id();
+    }
+    if (positionsBySession.empty()) {
+        trimGroupSessions();
+        return;
     }
+
+    std::vector<const std::vector<size_t>*> tasks;
+    size_t totalEncrypted = 0;
+    for (const auto& [sessionId, positions] : positionsBySession) {
+        tasks.push_back(&positions);
+        totalEncrypted += positions.size();
+    }
+    // Each task only touches one session and the elements of `decryptions` at its positions
+    const auto decryptSessionEvents = [&events,
+                                       &decryptions](const std::vector<size_t>* positions) {
+        for (const auto pos : *positions) {
+            auto& [session, result] = decryptions[pos];
+            const auto* eeptr = eventCast<EncryptedEvent>(events[pos]);
+            result.emplace(session->decrypt(eeptr->ciphertext()));
+        }
+    };
+    // Spinning up the thread pool isn't worth it for a handful of events
+    static constexpr size_t MinEventsToParallelise = 8;
+    if (tasks.size() > 1 && totalEncrypted >= MinEventsToParallelise)
+        QtConcurrent::blockingMap(tasks, decryptSessionEvents);
+    else
+        std::ranges::for_each(tasks, decryptSessionEvents);
+    const auto decryptionNsecs = et.nsecsElapsed();
+
+    size_t totalDecrypted = 0;
+    for (size_t pos = 0; pos < events.size(); ++pos) {
+        const auto& [session, result] = decryptions[pos];
+        if (!result)
+            continue;
+        auto& eptr = events[pos];
+        const auto* eeptr = eventCast<EncryptedEvent>(eptr);
+        RoomEventPtr decrypted;
+        if (const auto plaintext =
+                acceptDecrypted(*session, *result, eeptr->id(), eeptr->originTimestamp());
+            !plaintext.isEmpty())
+            decrypted = makeDecryptedEvent(*eeptr, plaintext);
+        if (!decrypted) {
+            undecryptedEvents[eeptr->sessionId()] += eeptr->id();
+            continue;
+        }
+        ++totalDecrypted;
+        auto&& oldEvent = eventCast<EncryptedEvent>(std::exchange(eptr, std::move(decrypted)));
+        eptr->setOriginalEvent(std::move(oldEvent));
+    }
+    connection->database()->flushGroupSessionIndexRecords();
+    trimGroupSessions();
     if (totalDecrypted > 5 || et.nsecsElapsed() >= ProfilerMinNsecs)
-        qDebug(PROFILER)
-            << "Decrypted" << totalDecrypted << "events in" << et;
+        qDebug(PROFILER) << "Decrypted" << totalDecrypted << "events from" << tasks.size()
+                         << "megolm session(s) in" << et << "- of that, megolm decryption took"
+                         << decryptionNsecs / 1'000'000 << "ms";
 }
 
 //! \brief Make a redacted event
@@ -2629,6 +3232,7 @@ bool Room::Private::processRedaction(const RedactionEvent& redaction)
     // Make a new event from the redacted JSON and put it in the timeline
     // instead of the redacted one. oldEvent will be deleted on return.
     auto oldEvent = ti.replaceEvent(makeRedacted(*ti, redaction));
+    updateStatsIndex(ti);
     qCDebug(EVENTS) << "Redacted" << oldEvent->id() << "with" << redaction.id();
     if (oldEvent->isStateEvent()) {
         // Check whether the old event was a part of current state; if it was,
@@ -2707,6 +3311,7 @@ bool Room::Private::processReplacement(const RoomMessageEvent& newEvent)
     // Make a new event from the redacted JSON and put it in the timeline
     // instead of the redacted one. oldEvent will be deleted on return.
     auto oldEvent = ti.replaceEvent(makeReplaced(*ti, newEvent));
+    updateStatsIndex(ti);
     qCDebug(STATE) << "Replaced" << oldEvent->id() << "with" << newEvent.id();
     emit q->replacedEvent(ti.event(), std::to_address(oldEvent));
     return true;
@@ -2799,16 +3404,26 @@ Room::Changes Room::Private::addNewMessageEvents(RoomEvents&& events)
         // treated.
         // NB: We have to store redacting/replacing events to the timeline too -
         // see #220.
-        auto it = std::find_if(events.begin(), events.end(), isEditing);
-        for (const auto& eptr : std::ranges::subrange(it, events.end())) {
+        const auto firstEditIt = std::find_if(events.begin(), events.end(), isEditing);
+        // Positions of events in the batch, to find targets of redactions and edits; events
+        // are only ever replaced in place below so the positions stay valid
+        std::unordered_map<QString, size_t> batchIndex;
+        if (firstEditIt != events.end()) {
+            batchIndex.reserve(events.size());
+            for (size_t i = 0; i < events.size(); ++i)
+                batchIndex.try_emplace(events[i]->id(), i);
+        }
+        for (auto pos = size_t(firstEditIt - events.begin()); pos < events.size(); ++pos) {
+            const auto& eptr = events[pos];
             if (auto* r = eventCast<RedactionEvent>(eptr)) {
                 // Try to find the target in the timeline, then in the batch.
                 if (processRedaction(*r))
                     continue;
-                if (auto targetIt = findIndirect(events, r->redactedEvent(), &RoomEvent::id);
-                    targetIt != events.end())
-                    *targetIt = makeRedacted(**targetIt, *r);
-                else
+                if (const auto targetIt = batchIndex.find(r->redactedEvent());
+                    targetIt != batchIndex.end()) {
+                    auto& target = events[targetIt->second];
+                    target = makeRedacted(*target, *r);
+                } else
                     qCDebug(STATE)
                         << "Redaction" << r->id() << "ignored: target event"
                         << r->redactedEvent() << "is not found";
@@ -2818,11 +3433,12 @@ Room::Changes Room::Private::addNewMessageEvents(RoomEvents&& events)
                     msg && !msg->replacedEvent().isEmpty()) {
                 if (processReplacement(*msg))
                     continue;
-                if (auto targetIt =
-                        findIndirect(events.begin(), it, msg->replacedEvent(), &RoomEvent::id);
-                    targetIt != it)
-                    *targetIt = makeReplaced(**targetIt, *msg);
-                else // FIXME: hide the replacing event when target arrives later
+                // Only events preceding the replacing one can be its targets
+                if (const auto targetIt = batchIndex.find(msg->replacedEvent());
+                    targetIt != batchIndex.end() && targetIt->second < pos) {
+                    auto& target = events[targetIt->second];
+                    target = makeReplaced(*target, *msg);
+                } else // FIXME: hide the replacing event when target arrives later
                     qCDebug(EVENTS)
                         << "Replacing event" << msg->id()
                         << "ignored: target event" << msg->replacedEvent()
@@ -2978,6 +3594,91 @@ std::pair<Room::Changes, Room::rev_iter_t> Room::Private::addHistoricalMessageEv
     return { changes, from };
 }
 
+void Room::Private::evictOldEvents()
+{
+    const auto sizeLimit = connection->timelineSizeLimit();
+    if (sizeLimit <= 0 || displayed || timeline.size() <= size_t(sizeLimit))
+        return;
+
+    // The new timeline front should have a known token to request the evicted events back with;
+    // if no event within the limit has one, evict less, down to the closest event that has it
+    const auto hasToken = [this](size_t pos) {
+        return batchPrevTokens.contains(timeline[pos]->id());
+    };
+    const auto minEvicted = timeline.size() - size_t(sizeLimit);
+    auto evictedCount = minEvicted;
+    while (evictedCount < timeline.size() && !hasToken(evictedCount))
+        ++evictedCount;
+    if (evictedCount == timeline.size()) {
+        evictedCount = minEvicted;
+        while (evictedCount > 0 && !hasToken(evictedCount))
+            --evictedCount;
+        if (evictedCount == 0) {
+            qCDebug(MESSAGES) << "No batch token to restore the history of" << q->objectName()
+                              << "from, will not evict events";
+            return;
+        }
+    }
+
+    QElapsedTimer et;
+    et.start();
+    const auto localReadReceiptId = q->lastLocalReadReceipt().eventId;
+    const auto hadFullyReadEvent = eventsIndex.contains(fullyReadUntilEventId);
+    const auto hadReadReceiptEvent = eventsIndex.contains(localReadReceiptId);
+    const auto usesEncryption = q->usesEncryption();
+
+    const auto fromIndex = timeline.front().index();
+    const auto toIndex = timeline[evictedCount - 1].index();
+    emit q->aboutToRemoveHistoricalMessages(fromIndex, toIndex);
+    for (size_t i = 0; i < evictedCount; ++i) {
+        const auto& ti = timeline.front();
+        const auto& evtId = ti->id();
+        eventsIndex.remove(evtId);
+        notifications.remove(evtId);
+        batchPrevTokens.remove(evtId);
+        if (usesEncryption)
+            FileMetadataMap::remove(id, evtId);
+        if (const auto* reaction = ti.viewAs<ReactionEvent>()) {
+            const auto& content = reaction->content().value;
+            if (const auto it = relations.find({ content.eventId, content.type });
+                it != relations.end()) {
+                it->removeOne(reaction);
+                if (it->isEmpty())
+                    relations.erase(it);
+            }
+        }
+        if (const auto* encryptedEvent = ti.viewAs<EncryptedEvent>())
+            if (const auto it = undecryptedEvents.find(encryptedEvent->sessionId());
+                it != undecryptedEvents.end())
+                it->second.remove(evtId);
+        timeline.pop_front();
+    }
+
+    const auto oldPrevBatch = std::exchange(prevBatch, batchPrevTokens.value(timeline.front()->id()));
+    if (!oldPrevBatch)
+        emit q->allHistoryLoadedChanged();
+    // The evicted events are gone from the local timeline cache as well, see prepareCachedTimeline()
+    hasCachedHistory = false;
+
+    Changes changes{};
+    // The statistics keep counting evicted events but become estimates if the marker is gone
+    if (hadFullyReadEvent && !eventsIndex.contains(fullyReadUntilEventId)) {
+        partiallyReadStats.isEstimate = true;
+        changes |= Change::PartiallyReadStats;
+    }
+    if (hadReadReceiptEvent && !eventsIndex.contains(localReadReceiptId)) {
+        unreadStats.isEstimate = true;
+        changes |= Change::UnreadStats;
+    }
+    emit q->removedHistoricalMessages(fromIndex, toIndex);
+    if (changes != 0)
+        postprocessChanges(changes, false);
+    qCDebug(MESSAGES) << "Evicted" << evictedCount << "old event(s) from" << q->objectName();
+    if (et.nsecsElapsed() >= ProfilerMinNsecs)
+        qCDebug(PROFILER) << "Evicted" << evictedCount << "old event(s) from" << q->objectName()
+                          << "in" << et;
+}
+
 void Room::Private::preprocessStateEvent(const RoomEvent& newEvent,
                                          const RoomEvent* curEvent)
 {
@@ -2988,10 +3689,8 @@ void Room::Private::preprocessStateEvent(const RoomEvent& newEvent,
                              eventCast<const RoomMemberEvent>(curEvent))
                             .value_or(Membership::Leave)) {
             case Membership::Invite:
-                if (rme.membership() != prevMembership) {
-                    membersInvited.removeOne(rme.userId());
-                    Q_ASSERT(!membersInvited.contains(rme.userId()));
-                }
+                if (rme.membership() != prevMembership)
+                    removeMemberId(Membership::Invite, rme.userId());
                 break;
             case Membership::Join: {
                 if (rme.membership() == Membership::Join) {
@@ -3010,6 +3709,7 @@ void Room::Private::preprocessStateEvent(const RoomEvent& newEvent,
                             << "Membership change from Join to Invite:" << rme;
                     // whatever the new membership, it's no more Join
                     removeMemberFromMap(rme.userId());
+                    removeMemberId(Membership::Join, rme.userId());
                     emit q->memberLeft(q->member(rme.userId()));
                 }
                 break;
@@ -3018,10 +3718,8 @@ void Room::Private::preprocessStateEvent(const RoomEvent& newEvent,
             case Membership::Knock:
             case Membership::Leave:
                 if (rme.membership() == Membership::Invite
-                    || rme.membership() == Membership::Join) {
-                    membersLeft.removeOne(rme.userId());
-                    Q_ASSERT(!membersLeft.contains(rme.userId()));
-                }
+                    || rme.membership() == Membership::Join)
+                    removeMemberId(Membership::Leave, rme.userId());
                 break;
             case Membership::Undefined:
                 ; // A warning will be dropped in Room::P::processStateEvent()
@@ -3045,15 +3743,11 @@ Room::Changes Room::processStateEvent(const RoomEvent& e)
     if (!e.isStateEvent())
         return Change::None;
 
-    // Find a value (create an empty one if necessary) and get a reference
-    // to it, anticipating a change further in the function.
-    auto& curStateEvent = d->currentState[{ e.matrixType(), e.stateKey() }];
-
-    d->preprocessStateEvent(e, curStateEvent);
+    d->preprocessStateEvent(e, d->currentState.get(e.matrixType(), e.stateKey()));
 
     // Change the state
-    const auto* const oldStateEvent =
-        std::exchange(curStateEvent, static_cast<const StateEvent*>(&e));
+    const auto& curStateEvent = static_cast<const StateEvent&>(e);
+    const auto* const oldStateEvent = d->currentState.replace(&curStateEvent);
     Q_ASSERT(!oldStateEvent
              || (oldStateEvent->matrixType() == e.matrixType()
                  && oldStateEvent->stateKey() == e.stateKey()));
@@ -3062,13 +3756,13 @@ Room::Changes Room::processStateEvent(const RoomEvent& e)
     else
         qCDebug(STATE) << "Updated room state:" << e;
 
-    const auto result = d->processStateEvent(*curStateEvent, oldStateEvent);
+    const auto result = d->processStateEvent(curStateEvent, oldStateEvent);
 
     Q_ASSERT(result != Change::None);
     // Whatever the outcome, the relevant piece of state should stay valid
     // (the absense of event is a valid state, too)
-    Q_ASSERT(currentState().queryOr(e.matrixType(), e.stateKey(),
-                                    &Event::isStateEvent, true));
+    Q_ASSERT(d->currentState.queryOr(e.matrixType(), e.stateKey(),
+                                     &Event::isStateEvent, true));
     return result;
 }
 
@@ -3115,6 +3809,7 @@ Room::Change Room::Private::processStateEvent(const RoomEvent& curEvent,
             case Membership::Join: {
                 if (prevMembership != Membership::Join) {
                     insertMemberIntoMap(evt.userId());
+                    addMemberId(Membership::Join, evt.userId());
                     emit q->memberJoined(q->member(evt.userId()));
                 } else {
                     if (evt.newDisplayName()) {
@@ -3128,16 +3823,14 @@ Room::Change Room::Private::processStateEvent(const RoomEvent& curEvent,
                 break;
             }
             case Membership::Invite:
-                if (!membersInvited.contains(evt.userId()))
-                        membersInvited.push_back(evt.userId());
+                addMemberId(Membership::Invite, evt.userId());
                 if (evt.userId() == connection->userId() && evt.isDirect())
                     connection->addToDirectChats(q, evt.userId());
                 break;
             case Membership::Knock:
             case Membership::Ban:
             case Membership::Leave:
-                if (!membersLeft.contains(evt.userId()))
-                    membersLeft.append(evt.userId());
+                addMemberId(Membership::Leave, evt.userId());
                 break;
             case Membership::Undefined:
                 qCWarning(MEMBERS) << "Ignored undefined membership type";
@@ -3377,6 +4070,27 @@ void Room::Private::updateDisplayname()
     }
 }
 
+namespace {
+QJsonObject stateEventToCache(const StateEvent& evt)
+{
+    auto json = evt.fullJson();
+    auto unsignedJson = evt.unsignedJson();
+    unsignedJson.remove(QStringLiteral("prev_content"));
+    json[UnsignedKey] = unsignedJson;
+    return json;
+}
+
+QJsonObject accountDataToCache(const std::unordered_map<QString, EventPtr>& accountData)
+{
+    QJsonArray accountDataEvents;
+    for (const auto& e : accountData) {
+        if (!e.second->contentJson().isEmpty())
+            accountDataEvents.append(e.second->fullJson());
+    }
+    return { { QStringLiteral("events"), accountDataEvents } };
+}
+}
+
 QJsonObject Room::Private::toJson() const
 {
     QElapsedTimer et;
@@ -3392,11 +4106,7 @@ QJsonObject Room::Private::toJson() const
                 || evt->contentJson().isEmpty())
                 continue;
 
-            auto json = evt->fullJson();
-            auto unsignedJson = evt->unsignedJson();
-            unsignedJson.remove(QStringLiteral("prev_content"));
-            json[UnsignedKey] = unsignedJson;
-            stateEvents.append(json);
+            stateEvents.append(stateEventToCache(*evt));
         }
 
         const auto stateObjName = joinState == JoinState::Invite
@@ -3406,16 +4116,8 @@ QJsonObject Room::Private::toJson() const
                       QJsonObject { { QStringLiteral("events"), stateEvents } });
     }
 
-    if (!accountData.empty()) {
-        QJsonArray accountDataEvents;
-        for (const auto& e : accountData) {
-            if (!e.second->contentJson().isEmpty())
-                accountDataEvents.append(e.second->fullJson());
-        }
-        result.insert(QStringLiteral("account_data"),
-                      QJsonObject {
-                          { QStringLiteral("events"), accountDataEvents } });
-    }
+    if (!accountData.empty())
+        result.insert(QStringLiteral("account_data"), accountDataToCache(accountData));
 
     if (const auto& readReceipt = q->lastReadReceipt(connection->userId());
         !readReceipt.eventId.isEmpty()) //
@@ -3443,7 +4145,51 @@ QJsonObject Room::Private::toJson() const
     return result;
 }
 
-QJsonObject Room::toJson() const { return d->toJson(); }
+QJsonObject Room::Private::toPreviewJson() const
+{
+    QJsonObject result;
+    addParam<IfNotEmpty>(result, QStringLiteral("summary"), summary);
+    {
+        // Only the state needed to show the room in a list: names, avatar, encryption
+        // and upgrade status, and member events used to calculate the display name
+        QJsonArray stateEvents;
+        const auto addStateEvent = [this, &stateEvents](const QString& evtType,
+                                                        const QString& stateKey = {}) {
+            if (const auto* evt = currentState.get(evtType, stateKey))
+                stateEvents.append(stateEventToCache(*evt));
+        };
+        for (const auto& evtType :
+             { RoomCreateEvent::TypeId, RoomNameEvent::TypeId, RoomCanonicalAliasEvent::TypeId,
+               RoomAvatarEvent::TypeId, RoomTopicEvent::TypeId, EncryptionEvent::TypeId,
+               RoomTombstoneEvent::TypeId })
+            addStateEvent(evtType);
+        addStateEvent(RoomMemberEvent::TypeId, connection->userId());
+        if (summary.heroes)
+            for (const auto& heroId : *summary.heroes)
+                addStateEvent(RoomMemberEvent::TypeId, heroId);
+
+        result.insert(joinState == JoinState::Invite ? QStringLiteral("invite_state")
+                                                     : QStringLiteral("state"),
+                      QJsonObject { { QStringLiteral("events"), stateEvents } });
+    }
+    if (!accountData.empty()) // Tags are needed to sort rooms
+        result.insert(QStringLiteral("account_data"), accountDataToCache(accountData));
+
+    result.insert(UnreadNotificationsKey,
+                  QJsonObject { { PartiallyReadCountKey,
+                                  countFromStats(partiallyReadStats) },
+                                { HighlightCountKey, serverHighlightCount } });
+    result.insert(NewUnreadCountKey, countFromStats(unreadStats));
+    return result;
+}
+
+QJsonObject Room::toJson() const
+{
+    d->loadDeferredState(); // Don't overwrite the full cached state with the preview
+    return d->toJson();
+}
+
+QJsonObject Room::toPreviewJson() const { return d->toPreviewJson(); }
 
 MemberSorter Room::memberSorter() const { return MemberSorter(); }
 
@@ -3458,23 +4204,20 @@ void Room::activateEncryption()
 
 void Room::addMegolmSessionFromBackup(const QByteArray& sessionId, const QByteArray& sessionKey, uint32_t index, const QByteArray& senderKey, const QByteArray& senderEdKey)
 {
-    const auto sessionIt = d->groupSessions.find(sessionId);
-    if (sessionIt != d->groupSessions.end() && sessionIt->second.firstKnownIndex() <= index)
+    if (const auto* existingSession = d->findGroupSession(sessionId);
+        existingSession && existingSession->firstKnownIndex() <= index)
         return;
 
     auto&& importResult = QOlmInboundGroupSession::importSession(sessionKey);
     if (!importResult)
         return;
-    // NB: after the next line, sessionIt can be invalid.
-    auto& session = d->groupSessions
-                        .insert_or_assign(sessionIt, sessionId,
-                                          std::move(importResult.value()))
-                        ->second;
+    auto& session = d->storeGroupSession(sessionId, std::move(importResult.value()));
     session.setOlmSessionId(d->connection->isVerifiedSession(sessionId)
                                 ? QByteArrayLiteral("BACKUP_VERIFIED")
                                 : QByteArrayLiteral("BACKUP"));
     session.setSenderId("BACKUP"_ls);
     d->connection->saveMegolmSession(this, session, senderKey, senderEdKey);
+    d->trimGroupSessions();
 }
 
 void Room::startVerification()
@@ -3489,7 +4232,8 @@ void Room::startVerification()
 QJsonArray Room::exportMegolmSessions()
 {
     QJsonArray sessions;
-    for (auto& [key, value] : d->groupSessions) {
+    // Sessions are always saved as soon as they're added, so the database has all of them
+    for (auto& [key, value] : connection()->loadRoomMegolmSessions(this)) {
         auto session = value.exportSession(value.firstKnownIndex());
         if (!session.has_value()) {
             qCWarning(E2EE) << "Failed to export session" << session.error();
@@ -29,6 +29,7 @@
 #include <QtGui/QImage>
 
 #include <deque>
+#include <functional>
 #include <utility>
 
 namespace Quotient {
@@ -43,6 +44,10 @@ class LeaveRoomJob;
 class SetRoomStateWithKeyJob;
 class RedactEventJob;
 
+namespace _impl {
+    class ConnectionEncryptionData;
+}
+
 /** The data structure used to expose file transfer information to views
  *
  * This is specifically tuned to work with QML exposing all traits as
@@ -315,9 +320,22 @@ public:
     //! The local member is excluded from this list.
     QList<RoomMember> otherMembersTyping() const;
 
-    //! Get a list of room member Matrix IDs who have joined the room.
+    //! \brief Get a list of room member Matrix IDs who have joined the room
+    //!
+    //! The list is sorted and maintained as member events come, so getting it is cheap.
+    //! \sa aboutToAddMemberId, aboutToRemoveMemberId, memberListsAboutToReset
     QStringList joinedMemberIds() const;
 
+    //! \brief Get a sorted list of Matrix IDs of users invited to the room
+    //! \sa joinedMemberIds
+    QStringList invitedMemberIds() const;
+
+    //! \brief Get a sorted list of Matrix IDs of users who left the room
+    //!
+    //! Apart from users who left on their own, this includes banned and knocking users.
+    //! \sa joinedMemberIds
+    QStringList leftMemberIds() const;
+
     //! Get a list of all member Matrix IDs known to the room.
     QStringList memberIds() const;
 
@@ -471,6 +489,11 @@ public:
     //!   the original event usually is);
     //! - from a non-local user (events from other devices of the local
     //!   user are not notable).
+    //!
+    //! The room remembers the result for each event when the event is added to
+    //! the timeline or replaced in it (e.g. upon redaction or decryption), and
+    //! uses it to count statistics; overrides should therefore only depend on
+    //! the event itself.
     //! \sa partiallyReadStats, unreadStats
     virtual bool isEventNotable(const TimelineItem& ti) const;
 
@@ -657,6 +680,12 @@ public:
     Q_INVOKABLE bool canSwitchVersions() const;
 
     /// \brief Get the current room state
+    ///
+    /// With Connection::deferredStateLoading() enabled, this only has the room preview
+    /// (names, avatar, encryption and the member events of heroes) until the full state
+    /// is loaded; the same goes for the member lists. Getters never load the full state
+    /// themselves; it's loaded once the room is displayed or gets an update from the server.
+    /// \sa setDisplayed
     RoomStateView currentState() const;
 
     //! \brief The effective power level of the given member in the room.
@@ -758,6 +787,13 @@ public Q_SLOTS:
     /// You shouldn't normally call this method; it's here for debugging
     void refreshDisplayName();
 
+    //! \brief Load up to \p limit events preceding the oldest event in the timeline
+    //!
+    //! If the connection keeps a timeline cache (see Connection::timelineCacheSize()) that has
+    //! older events of this room, these events are added to the timeline right away and
+    //! an empty handle is returned. Otherwise, the events are requested from the server; if
+    //! the whole room history has been loaded already, the returned handle is empty as well.
+    //! A non-empty \p filter always makes a request to the server.
     JobHandle<GetRoomEventsJob> getPreviousContent(int limit = 10, const QString &filter = {});
 
     void inviteToRoom(const QString& memberId);
@@ -810,6 +846,13 @@ Q_SIGNALS:
     void aboutToAddHistoricalMessages(Quotient::RoomEventsRange events);
     void aboutToAddNewMessages(Quotient::RoomEventsRange events);
     void addedMessages(int fromIndex, int toIndex);
+    //! \brief The oldest events are about to be removed from the timeline
+    //!
+    //! This happens when the timeline grows beyond Connection::timelineSizeLimit() while
+    //! the room is not displayed. The removed events can be loaded again with
+    //! getPreviousContent().
+    void aboutToRemoveHistoricalMessages(int fromIndex, int toIndex);
+    void removedHistoricalMessages(int fromIndex, int toIndex);
     /// The event is about to be appended to the list of pending events
     void pendingEventAboutToAdd(Quotient::RoomEvent* event);
     /// An event has been appended to the list of pending events
@@ -889,6 +932,25 @@ Q_SIGNALS:
      */
     void memberListChanged();
 
+    //! \brief A user id is about to be added to one of the member id lists
+    //!
+    //! \param membership Membership::Join, Membership::Invite or Membership::Leave, for
+    //!                   joinedMemberIds(), invitedMemberIds() and leftMemberIds() respectively
+    //! \param index the position the id will have in the list
+    void aboutToAddMemberId(Quotient::Membership membership, int index);
+    void addedMemberId(Quotient::Membership membership, int index);
+    //! \brief A user id is about to be removed from one of the member id lists
+    //! \sa aboutToAddMemberId
+    void aboutToRemoveMemberId(Quotient::Membership membership, int index);
+    void removedMemberId(Quotient::Membership membership, int index);
+    //! \brief All member id lists are about to be rebuilt
+    //!
+    //! This happens instead of adding ids one by one when a lot of member events is processed
+    //! at once; no aboutToAddMemberId() or aboutToRemoveMemberId() are emitted until
+    //! memberListsReset().
+    void memberListsAboutToReset();
+    void memberListsReset();
+
     /// The previously lazy-loaded members list is now loaded entirely
     /// \sa setDisplayed
     void allMembersLoaded();
@@ -959,10 +1021,38 @@ protected:
 
 private:
     friend class Connection;
+    friend class _impl::ConnectionEncryptionData;
+    friend struct EventStats;
 
     class Private;
     Private* d;
 
+    //! Save the outbound megolm session now if it has changed since it was last saved
+    void saveOutboundMegolmSession();
+    //! Record that \p devices have received the outbound megolm session with \p sessionId
+    void onDevicesReceivedKey(const QByteArray& sessionId,
+                              const QMultiHash<QString, QString>& devices);
+    //! Record that sending the outbound megolm session with \p sessionId to \p devices failed
+    void onDevicesFailedKey(const QByteArray& sessionId,
+                            const QMultiHash<QString, QString>& devices);
+
+    //! \brief Count notable and highlighted events with indices from \p first to \p last
+    //!
+    //! This uses the index maintained as events are added or replaced in the timeline, without
+    //! visiting events in the range. Both indices must be valid and \p first must not be
+    //! greater than \p last.
+    EventStats countEvents(TimelineItem::index_t first, TimelineItem::index_t last) const;
+
+    //! Get a small subset of the room data, enough to show it in a room list
+    QJsonObject toPreviewJson() const;
+    //! \brief Prepare writing the newest events of the timeline to the local timeline cache
+    //!
+    //! The timeline is serialised right away; the returned function only writes it to the store
+    //! passed to it and can be run in another thread. It's empty if there's nothing to write.
+    //! \sa TimelineStore::enqueueWrites
+    std::function<void(TimelineStore&)> prepareCachedTimeline(TimelineStore& store,
+                                                              int maxEvents) const;
+
     // This is called from Connection, reflecting a state change that
     // arrived from the server. Clients should use
     // Connection::joinRoom() and Room::leaveRoom() to change the state.
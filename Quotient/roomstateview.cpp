@@ -26,10 +26,27 @@ QJsonObject RoomStateView::contentJson(const QString& evtType,
 const QVector<const StateEvent*> RoomStateView::eventsOfType(
     const QString& evtType) const
 {
+    const auto typeIt = eventsByType.constFind(evtType);
+    if (typeIt == eventsByType.cend())
+        return {};
+
     auto vals = QVector<const StateEvent*>();
-    for (auto it = cbegin(); it != cend(); ++it)
-        if (it.key().first == evtType)
-            vals.append(it.value());
+    vals.reserve(typeIt->size());
+    for (const auto* evt : *typeIt)
+        vals.append(evt);
 
     return vals;
 }
+
+qsizetype RoomStateView::eventCountOfType(const QString& evtType) const
+{
+    return eventsByType.value(evtType).size();
+}
+
+const StateEvent* RoomStateView::replace(const StateEvent* evt)
+{
+    Q_ASSERT(evt != nullptr);
+    eventsByType[evt->matrixType()].insert(evt->stateKey(), evt);
+    auto& curEvt = (*this)[{ evt->matrixType(), evt->stateKey() }];
+    return std::exchange(curEvt, evt);
+}
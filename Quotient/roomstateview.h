@@ -123,6 +123,11 @@ public:
     //! the room of the given type.
     const QVector<const StateEvent*> eventsOfType(const QString& evtType) const;
 
+    //! \brief Get the number of state events in the room of a certain type
+    //!
+    //! This is a cheaper equivalent of `eventsOfType(evtType).size()`.
+    qsizetype eventCountOfType(const QString& evtType) const;
+
     //! \brief Run a function on a state event with the given type and key
     //!
     //! Use this overload when there's no predefined event type or the event
@@ -206,5 +211,12 @@ public:
 
 private:
     friend class Room;
+
+    //! \brief Put \p evt to the state, in place of the event with the same type and state key
+    //! \return the replaced event; `nullptr` if there was none
+    const StateEvent* replace(const StateEvent* evt);
+
+    //! The same events as in the main hash, indexed by event type and then by state key
+    QHash<QString, QHash<QString, const StateEvent*>> eventsByType;
 };
 } // namespace Quotient
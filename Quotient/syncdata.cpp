@@ -147,7 +147,8 @@ QJsonObject loadJson(const QString& fileName)
 }
 }
 
-SyncData::SyncData(const QString& cacheFileName)
+SyncData::SyncData(const QString& cacheFileName, bool withRoomStates)
+    : withRoomStates(withRoomStates)
 {
     auto json = loadJson(cacheFileName);
     auto requiredVersion = MajorCacheVersion;
@@ -163,6 +164,8 @@ SyncData::SyncData(const QString& cacheFileName)
 
 SyncDataList SyncData::takeRoomData() { return std::move(roomData); }
 
+QJsonObject SyncData::loadCacheFile(const QString& fileName) { return loadJson(fileName); }
+
 QString SyncData::fileNameForRoom(QString roomId)
 {
     roomId.replace(u':', u'_');
@@ -177,7 +180,7 @@ Events SyncData::takeToDeviceEvents() { return std::move(toDeviceEvents); }
 
 std::pair<int, int> SyncData::cacheVersion()
 {
-    return { MajorCacheVersion, 3 };
+    return { MajorCacheVersion, 4 };
 }
 
 DevicesList SyncData::takeDevicesList() { return std::move(devicesList); }
@@ -211,15 +214,24 @@ void SyncData::parseJson(const QJsonObject& json, const QString& baseDir)
         roomData.reserve(roomData.size() + static_cast<size_t>(rs.size()));
         for (auto roomIt = rs.begin(); roomIt != rs.end(); ++roomIt) {
             QJsonObject roomJson;
+            QString stateCacheFile;
             // Normally (i.e. in a /sync response) the received JSON is
             // self-contained; but the local cache stores state for each room in
             // its own file, loaded below
             if (Q_UNLIKELY(!baseDir.isEmpty())) {
-                roomJson = loadJson(
+                const auto roomRef = roomIt->toObject();
+                const auto fileName =
                     baseDir
                     + (roomIt->isObject() // lib 0.8.1.2 onwards = cache 11.3 onwards
-                           ? roomIt->toObject().value("$ref"_ls).toString()
-                           : fileNameForRoom(roomIt.key()))); // lib pre-0.8.1.2 = cache pre-11.3
+                           ? roomRef.value("$ref"_ls).toString()
+                           : fileNameForRoom(roomIt.key())); // lib pre-0.8.1.2 = cache pre-11.3
+                // Cache 11.4 onwards has a preview for each room in the top-level file
+                if (const auto preview = roomRef.value("preview"_ls).toObject();
+                    !withRoomStates && !preview.isEmpty()) {
+                    roomJson = preview;
+                    stateCacheFile = fileName;
+                } else
+                    roomJson = loadJson(fileName);
                 if (roomJson.isEmpty()) {
                     unresolvedRoomIds.push_back(roomIt.key());
                     continue;
@@ -228,7 +240,8 @@ void SyncData::parseJson(const QJsonObject& json, const QString& baseDir)
                 roomJson = roomIt->toObject();
 
             roomData.emplace_back(roomIt.key(), joinState, roomJson);
-            const auto& r = roomData.back();
+            auto& r = roomData.back();
+            r.stateCacheFile = std::move(stateCacheFile);
             totalEvents += r.state.size() + r.ephemeral.size()
                            + r.accountData.size() + r.timeline.size();
         }
@@ -72,6 +72,9 @@ public:
     std::optional<int> partiallyReadCount;
     std::optional<int> unreadCount;
     std::optional<int> highlightCount;
+    //! \brief The cache file with the full room state, if only its preview has been loaded
+    //! \sa SyncData::SyncData
+    QString stateCacheFile;
 
     SyncRoomData(QString roomId, JoinState joinState,
                  const QJsonObject& roomJson);
@@ -83,7 +86,12 @@ using SyncDataList = std::vector<SyncRoomData>;
 class QUOTIENT_API SyncData {
 public:
     SyncData() = default;
-    explicit SyncData(const QString& cacheFileName);
+    //! \brief Load the sync data from the top-level state cache file
+    //!
+    //! If \p withRoomStates is false, rooms that have a preview in the top-level file (cache 11.4
+    //! onwards) are filled from that preview instead of reading their own cache files;
+    //! SyncRoomData::stateCacheFile then points to the file with the full room state.
+    explicit SyncData(const QString& cacheFileName, bool withRoomStates = true);
     //! Parse sync response into room events
     //! \param json response from /sync or a room state cache
     void parseJson(const QJsonObject& json, const QString& baseDir = {});
@@ -105,6 +113,8 @@ public:
     static constexpr int MajorCacheVersion = 11;
     static std::pair<int, int> cacheVersion();
     static QString fileNameForRoom(QString roomId);
+    //! Read a (top-level or room) state cache file, either JSON or CBOR
+    static QJsonObject loadCacheFile(const QString& fileName);
 
 private:
     QString nextBatch_;
@@ -115,5 +125,6 @@ private:
     QStringList unresolvedRoomIds;
     QHash<QString, int> deviceOneTimeKeysCount_;
     DevicesList devicesList;
+    bool withRoomStates = true;
 };
 } // namespace Quotient
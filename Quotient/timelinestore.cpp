@@ -0,0 +1,259 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "timelinestore.h"
+
+#include "logging_categories_p.h"
+#include "util.h"
+
+#include <QtCore/QJsonDocument>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+
+using namespace Quotient;
+
+TimelineStore::TimelineStore(const QString& filePath, const QString& connectionName)
+    : m_filePath(filePath), m_connectionName(connectionName)
+{
+    auto db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), m_connectionName);
+    db.setDatabaseName(filePath);
+    if (!db.open()) {
+        qCritical(DATABASE) << "Failed to open the timeline cache at" << filePath << ":"
+                            << db.lastError();
+        return;
+    }
+
+    switch (version()) {
+    case 0: migrateTo1();
+    }
+}
+
+TimelineStore::~TimelineStore()
+{
+    waitForWrites();
+    database().close();
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+QSqlDatabase TimelineStore::database() const
+{
+    return QSqlDatabase::database(m_connectionName, false);
+}
+
+QSqlQuery TimelineStore::prepareQuery(const QString& queryString) const
+{
+    QSqlQuery query(database());
+    query.prepare(queryString);
+    return query;
+}
+
+void TimelineStore::execute(QSqlQuery& query)
+{
+    if (!query.exec()) {
+        qCritical(DATABASE) << "Failed to execute query";
+        qCritical(DATABASE) << query.lastQuery();
+        qCritical(DATABASE) << query.lastError();
+    }
+}
+
+int TimelineStore::version()
+{
+    auto query = prepareQuery(QStringLiteral("PRAGMA user_version;"));
+    execute(query);
+    if (query.next()) {
+        bool ok = false;
+        int value = query.value(0).toInt(&ok);
+        qCDebug(DATABASE) << "Timeline cache version" << value;
+        if (ok)
+            return value;
+    } else {
+        qCritical(DATABASE) << "Failed to check timeline cache version";
+    }
+    return -1;
+}
+
+void TimelineStore::enqueueWrites(Writes writes)
+{
+    if (!m_writer) {
+        m_writer = std::make_unique<QThreadPool>();
+        m_writer->setMaxThreadCount(1); // Keep the writes in the order they were queued
+    }
+    m_writer->start([filePath = m_filePath, connectionName = m_connectionName + "_writer"_ls,
+                     writes = std::move(writes)] {
+        // QSqlDatabase connections can't be shared between threads; a short-lived one is
+        // cheap enough for a batch of writes
+        TimelineStore store(filePath, connectionName);
+        writes(store);
+    });
+}
+
+void TimelineStore::waitForWrites()
+{
+    if (m_writer)
+        m_writer->waitForDone();
+}
+
+void TimelineStore::transaction()
+{
+    database().transaction();
+}
+
+void TimelineStore::commit()
+{
+    database().commit();
+}
+
+void TimelineStore::migrateTo1()
+{
+    qCDebug(DATABASE) << "Migrating timeline cache to version 1";
+    transaction();
+    for (auto&& q :
+         { QStringLiteral("CREATE TABLE timeline_events (roomId TEXT, seq INTEGER, eventId TEXT, "
+                          "json TEXT, PRIMARY KEY(roomId, seq));"),
+           QStringLiteral("CREATE UNIQUE INDEX timeline_events_id_idx ON timeline_events(roomId, "
+                          "eventId);"),
+           QStringLiteral("CREATE TABLE timeline_rooms (roomId TEXT PRIMARY KEY, prevBatch TEXT, "
+                          "historyComplete INTEGER);"),
+           QStringLiteral("PRAGMA user_version = 1;") }) {
+        auto query = prepareQuery(q);
+        execute(query);
+    }
+    commit();
+}
+
+qint64 TimelineStore::endSeq(const QString& roomId)
+{
+    waitForWrites();
+    auto query =
+        prepareQuery(QStringLiteral("SELECT MAX(seq) FROM timeline_events WHERE roomId=:roomId;"));
+    query.bindValue(":roomId"_ls, roomId);
+    execute(query);
+    // MAX() over no rows gives NULL
+    return query.next() && !query.isNull(0) ? query.value(0).toLongLong() + 1 : 0;
+}
+
+qint64 TimelineStore::initialEndSeq(const QString& roomId)
+{
+    if (!m_initialEndSeqs) {
+        auto query = prepareQuery(
+            QStringLiteral("SELECT roomId, MAX(seq) FROM timeline_events GROUP BY roomId;"));
+        waitForWrites();
+        execute(query);
+        m_initialEndSeqs.emplace();
+        while (query.next())
+            m_initialEndSeqs->insert(query.value(0).toString(), query.value(1).toLongLong() + 1);
+    }
+    return m_initialEndSeqs->value(roomId);
+}
+
+TimelineStore::CachedEvents TimelineStore::loadEvents(const QString& roomId, qint64 beforeSeq,
+                                                      int limit)
+{
+    waitForWrites();
+    auto query = prepareQuery(
+        QStringLiteral("SELECT seq, json FROM timeline_events WHERE roomId=:roomId AND "
+                       "seq<:beforeSeq ORDER BY seq DESC LIMIT :limit;"));
+    query.bindValue(":roomId"_ls, roomId);
+    query.bindValue(":beforeSeq"_ls, beforeSeq);
+    query.bindValue(":limit"_ls, limit);
+    execute(query);
+    CachedEvents events;
+    events.reserve(size_t(limit));
+    while (query.next()) {
+        const auto json = QJsonDocument::fromJson(query.value("json"_ls).toByteArray()).object();
+        if (json.isEmpty()) {
+            qCWarning(DATABASE) << "Skipping a malformed cached event in" << roomId;
+            continue;
+        }
+        events.emplace_back(query.value("seq"_ls).toLongLong(), json);
+    }
+    return events;
+}
+
+bool TimelineStore::saveEvents(const QString& roomId, qint64 fromSeq, const QJsonArray& events,
+                               int maxEvents)
+{
+    auto deleteQuery = prepareQuery(
+        QStringLiteral("DELETE FROM timeline_events WHERE roomId=:roomId AND seq>=:fromSeq;"));
+    deleteQuery.bindValue(":roomId"_ls, roomId);
+    deleteQuery.bindValue(":fromSeq"_ls, fromSeq);
+    execute(deleteQuery);
+
+    // The same event may still be stored among older events if the previous session saved
+    // the timeline after it saved the sync token; REPLACE moves such events to the new position
+    auto insertQuery = prepareQuery(
+        QStringLiteral("INSERT OR REPLACE INTO timeline_events(roomId, seq, eventId, json) "
+                       "VALUES(:roomId, :seq, :eventId, :json);"));
+    auto seq = fromSeq;
+    for (const auto& e : events) {
+        const auto json = e.toObject();
+        insertQuery.bindValue(":roomId"_ls, roomId);
+        insertQuery.bindValue(":seq"_ls, seq++);
+        insertQuery.bindValue(":eventId"_ls, json.value("event_id"_ls).toString());
+        insertQuery.bindValue(":json"_ls, QJsonDocument(json).toJson(QJsonDocument::Compact));
+        execute(insertQuery);
+    }
+
+    auto trimQuery = prepareQuery(
+        QStringLiteral("DELETE FROM timeline_events WHERE roomId=:roomId AND seq<:minSeq;"));
+    trimQuery.bindValue(":roomId"_ls, roomId);
+    trimQuery.bindValue(":minSeq"_ls, seq - maxEvents);
+    execute(trimQuery);
+    return trimQuery.numRowsAffected() > 0;
+}
+
+std::optional<QString> TimelineStore::prevBatch(const QString& roomId)
+{
+    waitForWrites();
+    auto query = prepareQuery(QStringLiteral(
+        "SELECT prevBatch, historyComplete FROM timeline_rooms WHERE roomId=:roomId;"));
+    query.bindValue(":roomId"_ls, roomId);
+    execute(query);
+    if (!query.next())
+        return QString();
+    if (query.value("historyComplete"_ls).toBool())
+        return std::nullopt;
+    return query.value("prevBatch"_ls).toString();
+}
+
+void TimelineStore::setPrevBatch(const QString& roomId, const std::optional<QString>& prevBatch)
+{
+    auto query = prepareQuery(
+        QStringLiteral("INSERT OR REPLACE INTO timeline_rooms(roomId, prevBatch, historyComplete) "
+                       "VALUES(:roomId, :prevBatch, :historyComplete);"));
+    query.bindValue(":roomId"_ls, roomId);
+    query.bindValue(":prevBatch"_ls, prevBatch.value_or(QString()));
+    query.bindValue(":historyComplete"_ls, !prevBatch.has_value());
+    execute(query);
+}
+
+void TimelineStore::clearRoom(const QString& roomId)
+{
+    transaction();
+    for (const auto& queryText :
+         { QStringLiteral("DELETE FROM timeline_events WHERE roomId=:roomId;"),
+           QStringLiteral("DELETE FROM timeline_rooms WHERE roomId=:roomId;") }) {
+        auto q = prepareQuery(queryText);
+        q.bindValue(QStringLiteral(":roomId"), roomId);
+        execute(q);
+    }
+    commit();
+}
+
+void TimelineStore::enqueueClearRoom(const QString& roomId)
+{
+    if (m_initialEndSeqs)
+        m_initialEndSeqs->remove(roomId);
+    enqueueWrites([roomId](TimelineStore& store) { store.clearRoom(roomId); });
+}
+
+void TimelineStore::clear()
+{
+    transaction();
+    for (auto&& q : { QStringLiteral("DELETE FROM timeline_events;"),
+                      QStringLiteral("DELETE FROM timeline_rooms;") }) {
+        auto query = prepareQuery(q);
+        execute(query);
+    }
+    commit();
+}
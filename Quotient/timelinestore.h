@@ -0,0 +1,97 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include "quotient_export.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
+#include <QtCore/QThreadPool>
+#include <QtSql/QSqlQuery>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace Quotient {
+
+//! \brief An on-disk store of the most recent timeline events of rooms
+//!
+//! Each room gets a contiguous run of events, numbered with ascending sequence numbers from
+//! the oldest to the newest, and the previous batch token for the oldest of them. Rooms use it to
+//! show their history offline right after startup and to serve back-pagination before going
+//! to the network. All calls are synchronous, and the store must only be used from the thread
+//! it's been created in; to keep the writes off that thread, pass them to enqueueWrites().
+//! \sa Connection::timelineStore, Connection::timelineCacheSize
+class QUOTIENT_API TimelineStore {
+public:
+    //! Events in full JSON, each with its sequence number; the newest event goes first
+    using CachedEvents = std::vector<std::pair<qint64, QJsonObject>>;
+    using Writes = std::function<void(TimelineStore&)>;
+
+    TimelineStore(const QString& filePath, const QString& connectionName);
+    ~TimelineStore();
+    Q_DISABLE_COPY_MOVE(TimelineStore)
+
+    //! \brief Make writes to the store in a background thread
+    //!
+    //! \p writes is invoked with another store opened on the same file in that thread; queued
+    //! writes are done one after another, in the order of the calls. The methods reading
+    //! from this store wait until all queued writes are done, so they never see stale data.
+    void enqueueWrites(Writes writes);
+    //! Wait until the writes queued with enqueueWrites() are done
+    void waitForWrites();
+
+    void transaction();
+    void commit();
+
+    //! The sequence number following the newest stored event of the room; 0 if there's none
+    qint64 endSeq(const QString& roomId);
+    //! \brief The value of endSeq() as of the first call to this method
+    //!
+    //! The numbers for all rooms are read in one go on the first call; after that, this
+    //! doesn't touch the database, and doesn't wait for queued writes as endSeq() does. Rooms
+    //! cleared with enqueueClearRoom() since then count as empty. Use this to find out where
+    //! the events stored by previous sessions end.
+    qint64 initialEndSeq(const QString& roomId);
+    //! \brief Load up to \p limit events of the room that are older than \p beforeSeq
+    //! \return the events, newest first
+    CachedEvents loadEvents(const QString& roomId, qint64 beforeSeq, int limit);
+    //! \brief Replace the room's events starting from \p fromSeq with \p events
+    //!
+    //! \p events should be ordered from the oldest to the newest; they get sequence numbers
+    //! starting at \p fromSeq. After that, only \p maxEvents newest events of the room are kept.
+    //! \return whether any older events have been dropped to fit into \p maxEvents
+    bool saveEvents(const QString& roomId, qint64 fromSeq, const QJsonArray& events,
+                    int maxEvents);
+
+    //! \brief The previous batch token for the oldest stored event of the room
+    //!
+    //! Follows the semantics of the room's own previous batch token: an empty string means that
+    //! the token is unknown; `std::nullopt` means that the oldest stored event is the first one
+    //! in the room.
+    std::optional<QString> prevBatch(const QString& roomId);
+    void setPrevBatch(const QString& roomId, const std::optional<QString>& prevBatch);
+
+    void clearRoom(const QString& roomId);
+    //! Call clearRoom() in a background thread, see enqueueWrites()
+    void enqueueClearRoom(const QString& roomId);
+    void clear();
+
+private:
+    QSqlDatabase database() const;
+    QSqlQuery prepareQuery(const QString& queryString) const;
+    void execute(QSqlQuery& query);
+    int version();
+
+    void migrateTo1();
+
+    QString m_filePath;
+    QString m_connectionName;
+    std::unique_ptr<QThreadPool> m_writer;
+    std::optional<QHash<QString, qint64>> m_initialEndSeqs;
+};
+} // namespace Quotient
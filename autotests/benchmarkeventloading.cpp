@@ -0,0 +1,142 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/events/accountdataevents.h>
+#include <Quotient/events/callevents.h>
+#include <Quotient/events/directchatevent.h>
+#include <Quotient/events/encryptedevent.h>
+#include <Quotient/events/encryptionevent.h>
+#include <Quotient/events/keyverificationevent.h>
+#include <Quotient/events/reactionevent.h>
+#include <Quotient/events/receiptevent.h>
+#include <Quotient/events/redactionevent.h>
+#include <Quotient/events/roomavatarevent.h>
+#include <Quotient/events/roomcanonicalaliasevent.h>
+#include <Quotient/events/roomcreateevent.h>
+#include <Quotient/events/roomkeyevent.h>
+#include <Quotient/events/roommemberevent.h>
+#include <Quotient/events/roommessageevent.h>
+#include <Quotient/events/roompowerlevelsevent.h>
+#include <Quotient/events/roomtombstoneevent.h>
+#include <Quotient/events/simplestateevents.h>
+#include <Quotient/events/stickerevent.h>
+#include <Quotient/events/typingevent.h>
+
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class BenchmarkEventLoading : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void sameResult();
+    void loadEvents_data();
+    void loadEvents();
+
+private:
+    QVector<QJsonObject> events;
+};
+
+namespace {
+QJsonObject eventJson(const QString& type, bool isState)
+{
+    QJsonObject json{ { TypeKey, type },
+                      { "event_id"_ls, QStringLiteral("$%1:localhost").arg(type) },
+                      { SenderKey, "@bench:localhost"_ls },
+                      { "origin_server_ts"_ls, 1700000000000 },
+                      { ContentKey, QJsonObject{} } };
+    if (isState)
+        json.insert(StateKeyKey, "@bench:localhost"_ls);
+    return json;
+}
+} // namespace
+
+void BenchmarkEventLoading::initTestCase()
+{
+    // Each event type known to the library, plus a few unknown types
+    const std::pair<event_type_t, bool> types[]{
+        { TagEvent::TypeId, false },
+        { ReadMarkerEvent::TypeId, false },
+        { IgnoredUsersEvent::TypeId, false },
+        { CallInviteEvent::TypeId, false },
+        { CallCandidatesEvent::TypeId, false },
+        { CallAnswerEvent::TypeId, false },
+        { CallHangupEvent::TypeId, false },
+        { DirectChatEvent::TypeId, false },
+        { EncryptedEvent::TypeId, false },
+        { DummyEvent::TypeId, false },
+        { EncryptionEvent::TypeId, true },
+        { KeyVerificationRequestEvent::TypeId, false },
+        { KeyVerificationReadyEvent::TypeId, false },
+        { KeyVerificationStartEvent::TypeId, false },
+        { KeyVerificationAcceptEvent::TypeId, false },
+        { KeyVerificationCancelEvent::TypeId, false },
+        { KeyVerificationKeyEvent::TypeId, false },
+        { KeyVerificationMacEvent::TypeId, false },
+        { KeyVerificationDoneEvent::TypeId, false },
+        { ReactionEvent::TypeId, false },
+        { ReceiptEvent::TypeId, false },
+        { RedactionEvent::TypeId, false },
+        { RoomAvatarEvent::TypeId, true },
+        { RoomCanonicalAliasEvent::TypeId, true },
+        { RoomCreateEvent::TypeId, true },
+        { RoomKeyEvent::TypeId, false },
+        { RoomMemberEvent::TypeId, true },
+        { RoomMessageEvent::TypeId, false },
+        { RoomPowerLevelsEvent::TypeId, true },
+        { RoomTombstoneEvent::TypeId, true },
+        { RoomNameEvent::TypeId, true },
+        { RoomTopicEvent::TypeId, true },
+        { RoomPinnedEventsEvent::TypeId, true },
+        { RoomServerAclEvent::TypeId, true },
+        { StickerEvent::TypeId, false },
+        { TypingEvent::TypeId, false },
+        { "org.example.unknown"_ls, false },
+        { "org.example.unknown_state"_ls, true },
+        // Known types in a wrong shape
+        { RoomMemberEvent::TypeId, false },
+        { RoomMessageEvent::TypeId, true },
+    };
+    for (const auto& [type, isState] : types)
+        events.push_back(eventJson(type, isState));
+}
+
+void BenchmarkEventLoading::sameResult()
+{
+    for (const auto& json : std::as_const(events)) {
+        const auto type = json[TypeKey].toString();
+        const auto fromTable = Event::BaseMetaType.loadFrom(json, type);
+        const auto fromHierarchy = Event::BaseMetaType.loadFromHierarchy(json, type);
+        QVERIFY(fromTable && fromHierarchy);
+        QCOMPARE(fromTable->metaType().className, fromHierarchy->metaType().className);
+
+        const auto roomEvent = RoomEvent::BaseMetaType.loadFrom(json, type);
+        const auto roomEventFromHierarchy = RoomEvent::BaseMetaType.loadFromHierarchy(json, type);
+        QVERIFY(roomEvent && roomEventFromHierarchy);
+        QCOMPARE(roomEvent->metaType().className, roomEventFromHierarchy->metaType().className);
+    }
+}
+
+void BenchmarkEventLoading::loadEvents_data()
+{
+    QTest::addColumn<bool>("useTable");
+    QTest::newRow("dispatch table") << true;
+    QTest::newRow("hierarchy walk") << false;
+}
+
+void BenchmarkEventLoading::loadEvents()
+{
+    QFETCH(bool, useTable);
+    QBENCHMARK {
+        for (const auto& json : std::as_const(events)) {
+            const auto type = json[TypeKey].toString();
+            const auto event = useTable ? Event::BaseMetaType.loadFrom(json, type)
+                                        : Event::BaseMetaType.loadFromHierarchy(json, type);
+            QVERIFY(event != nullptr);
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchmarkEventLoading)
+#include "benchmarkeventloading.moc"
@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/connection.h>
+#include <Quotient/room.h>
+#include <Quotient/syncdata.h>
+
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class BenchmarkRoom : public Room {
+public:
+    using Room::Room;
+    using Room::updateData;
+};
+
+class BenchmarkTimeline : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void ingestBatch_data();
+    void ingestBatch();
+
+private:
+    Connection* connection = nullptr;
+};
+
+namespace {
+const auto RoomId = QStringLiteral("!bench:localhost");
+
+QJsonObject messageJson(int n)
+{
+    return QJsonObject{ { "type"_ls, "m.room.message"_ls },
+                        { "event_id"_ls, QStringLiteral("$event%1:localhost").arg(n) },
+                        { "sender"_ls, "@bench:localhost"_ls },
+                        { "origin_server_ts"_ls, 1700000000000 + n },
+                        { "content"_ls,
+                          QJsonObject{ { "msgtype"_ls, "m.text"_ls },
+                                       { "body"_ls, QStringLiteral("Message %1").arg(n) } } } };
+}
+
+//! \brief Make a /sync room object with \p size timeline events
+//!
+//! Every 10th event repeats an earlier one, every 20th edits an earlier one and every 50th
+//! redacts an earlier one - all within the same batch.
+QJsonObject makeRoomJson(int size)
+{
+    QJsonArray events;
+    for (int i = 0; i < size; ++i) {
+        if (i > 0 && i % 10 == 0) {
+            events.append(messageJson(i - 1));
+            continue;
+        }
+        auto json = messageJson(i);
+        if (i > 0 && i % 20 == 1) {
+            const auto targetId = QStringLiteral("$event%1:localhost").arg(i / 3);
+            json["content"_ls] = QJsonObject{
+                { "msgtype"_ls, "m.text"_ls },
+                { "body"_ls, "* Edited"_ls },
+                { "m.new_content"_ls,
+                  QJsonObject{ { "msgtype"_ls, "m.text"_ls }, { "body"_ls, "Edited"_ls } } },
+                { "m.relates_to"_ls,
+                  QJsonObject{ { "rel_type"_ls, "m.replace"_ls }, { "event_id"_ls, targetId } } }
+            };
+        } else if (i > 0 && i % 50 == 3) {
+            json["type"_ls] = "m.room.redaction"_ls;
+            json["redacts"_ls] = QStringLiteral("$event%1:localhost").arg(i / 4);
+            json["content"_ls] = QJsonObject{};
+        }
+        events.append(json);
+    }
+    return QJsonObject{ { "timeline"_ls, QJsonObject{ { "events"_ls, events } } } };
+}
+} // namespace
+
+void BenchmarkTimeline::initTestCase()
+{
+    connection = Connection::makeMockConnection("@bench:localhost"_ls, false);
+}
+
+void BenchmarkTimeline::cleanupTestCase()
+{
+    delete connection;
+}
+
+void BenchmarkTimeline::ingestBatch_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("1k events") << 1'000;
+    QTest::newRow("10k events") << 10'000;
+}
+
+void BenchmarkTimeline::ingestBatch()
+{
+    QFETCH(int, size);
+    const auto roomJson = makeRoomJson(size);
+    int timelineSize = 0;
+    QBENCHMARK {
+        BenchmarkRoom room(connection, RoomId, JoinState::Join);
+        room.updateData(SyncRoomData(RoomId, JoinState::Join, roomJson));
+        timelineSize = room.timelineSize();
+    }
+    // Every 10th event is a duplicate and gets dropped
+    QCOMPARE(timelineSize, size - (size - 1) / 10);
+}
+
+QTEST_GUILESS_MAIN(BenchmarkTimeline)
+#include "benchmarktimeline.moc"
@@ -6,9 +6,11 @@
 #include <Quotient/database.h>
 #include <Quotient/e2ee/cryptoutils.h>
 #include <Quotient/e2ee/e2ee_common.h>
+#include <Quotient/e2ee/filecrypto.h>
 
 #include <Quotient/events/filesourceinfo.h>
 
+#include <QBuffer>
 #include <QTest>
 
 #include <olm/pk.h>
@@ -20,6 +22,9 @@ private slots:
     void aesCtrEncryptDecryptData();
     void hkdfSha256ExpandKeys();
     void encryptDecryptFile();
+    void aesCtrTransformAtOffset();
+    void encryptingDevice();
+    void fileDecryptor();
     void pbkdfGenerateKey();
     void hmac();
     void curve25519AesEncryptDecrypt();
@@ -52,6 +57,65 @@ void TestCryptoUtils::encryptDecryptFile()
     QCOMPARE(decrypted, data);
 }
 
+void TestCryptoUtils::aesCtrTransformAtOffset()
+{
+    const auto plain = QByteArray(100, 'x') + QByteArrayLiteral("ABCDEF");
+    const FixedBuffer<Aes256KeySize> key{};
+    // Make sure the counter carries over to the next byte
+    const auto iv = QByteArray(AesBlockSize - 1, '\0') + '\xfe';
+    const auto cipher = aesCtr256Encrypt(plain, key, asCBytes<AesBlockSize>(iv));
+    QVERIFY(cipher.has_value());
+    for (const qint64 offset : { 0, 5, 16, 33, 100 }) {
+        const auto fragment = aesCtr256Transform(plain.mid(offset), key,
+                                                 asCBytes<AesBlockSize>(iv), offset);
+        QVERIFY(fragment.has_value());
+        QCOMPARE(fragment.value(), cipher.value().mid(offset));
+    }
+}
+
+void TestCryptoUtils::encryptingDevice()
+{
+    QByteArray data;
+    for (int i = 0; i < 10'000; ++i)
+        data += QByteArray::number(i);
+    EncryptingDevice device(new QBuffer(&data));
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    QCOMPARE(device.size(), data.size());
+
+    // Read in chunks of uneven sizes, with a rewind in the middle as QNAM may do
+    QByteArray cipherText = device.read(1000);
+    QVERIFY(device.seek(0));
+    cipherText = device.read(17);
+    while (!device.atEnd())
+        cipherText += device.read(4093);
+    QCOMPARE(cipherText.size(), data.size());
+
+    auto metadata = device.metadata();
+    QVERIFY(metadata.has_value());
+    QCOMPARE(decryptFile(cipherText, *metadata), data);
+}
+
+void TestCryptoUtils::fileDecryptor()
+{
+    const auto data = QByteArray(5000, 'z') + QByteArrayLiteral("The end");
+    auto [metadata, cipherText] = encryptFile(data);
+    FileDecryptor decryptor(metadata);
+    QVERIFY(decryptor.isValid());
+    QByteArray decrypted;
+    for (qsizetype pos = 0; pos < cipherText.size(); pos += 777) {
+        auto chunk = decryptor.decrypt(cipherText.mid(pos, 777));
+        QVERIFY(chunk.has_value());
+        decrypted += chunk.value();
+    }
+    QCOMPARE(decrypted, data);
+    QVERIFY(decryptor.hashMatches());
+
+    cipherText[42] = static_cast<char>(cipherText[42] ^ 1);
+    FileDecryptor tamperedDecryptor(metadata);
+    QVERIFY(tamperedDecryptor.decrypt(cipherText).has_value());
+    QVERIFY(!tamperedDecryptor.hashMatches());
+}
+
 void TestCryptoUtils::hkdfSha256ExpandKeys()
 {
     auto result = hkdfSha256(zeroes<32>(), zeroes<32>(), zeroes<32>());
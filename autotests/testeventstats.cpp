@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/connection.h>
+#include <Quotient/eventstats.h>
+#include <Quotient/room.h>
+#include <Quotient/syncdata.h>
+
+#include <Quotient/e2ee/qolmoutboundsession.h>
+#include <Quotient/events/roomkeyevent.h>
+#include <Quotient/events/roommessageevent.h>
+
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class TestRoom : public Room {
+public:
+    using Room::Room;
+    using Room::updateData;
+};
+
+class TestEventStats : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void decryptAfterMarker();
+};
+
+namespace {
+const auto RoomId = QStringLiteral("!stats:localhost");
+const auto Sender = QStringLiteral("@friend:localhost");
+
+QString eventId(int n) { return QStringLiteral("$event%1:localhost").arg(n); }
+
+QJsonObject messageJson(int n)
+{
+    return QJsonObject{ { TypeKey, "m.room.message"_ls },
+                        { "event_id"_ls, eventId(n) },
+                        { SenderKey, Sender },
+                        { "origin_server_ts"_ls, 1700000000000 + n },
+                        { ContentKey,
+                          QJsonObject{ { "msgtype"_ls, "m.text"_ls },
+                                       { "body"_ls, QStringLiteral("Message %1").arg(n) } } } };
+}
+
+QJsonObject fullyReadJson(int n)
+{
+    return QJsonObject{ { "account_data"_ls,
+                          QJsonObject{ { "events"_ls,
+                                         QJsonArray{ QJsonObject{
+                                             { TypeKey, "m.fully_read"_ls },
+                                             { ContentKey, QJsonObject{ { "event_id"_ls,
+                                                                          eventId(n) } } } } } } } } };
+}
+} // namespace
+
+void TestEventStats::decryptAfterMarker()
+{
+    const std::unique_ptr<Connection> connection(
+        Connection::makeMockConnection("@me:localhost"_ls, true));
+    TestRoom room(connection.get(), RoomId, JoinState::Join);
+
+    const QOlmOutboundGroupSession megolmSession;
+    const auto sessionKey = megolmSession.sessionKey(); // Before the ratchet advances
+    const auto plaintext = QJsonObject{ { TypeKey, "m.room.message"_ls },
+                                        { "room_id"_ls, RoomId },
+                                        { ContentKey, QJsonObject{ { "msgtype"_ls, "m.text"_ls },
+                                                                   { "body"_ls, "Secret"_ls } } } };
+    const auto encryptedJson = QJsonObject{
+        { TypeKey, "m.room.encrypted"_ls },
+        { "event_id"_ls, eventId(2) },
+        { SenderKey, Sender },
+        { "origin_server_ts"_ls, 1700000000002 },
+        { ContentKey,
+          QJsonObject{ { "algorithm"_ls, "m.megolm.v1.aes-sha2"_ls },
+                       { "ciphertext"_ls, QString::fromLatin1(megolmSession.encrypt(
+                                              QJsonDocument(plaintext).toJson())) },
+                       { "sender_key"_ls, "senderkey"_ls },
+                       { "device_id"_ls, "FRIENDDEVICE"_ls },
+                       { "session_id"_ls, QString::fromLatin1(megolmSession.sessionId()) } } }
+    };
+    const auto encryptionJson =
+        QJsonObject{ { TypeKey, "m.room.encryption"_ls },
+                     { "event_id"_ls, eventId(0) },
+                     { "state_key"_ls, QString() },
+                     { SenderKey, Sender },
+                     { "origin_server_ts"_ls, 1700000000000 },
+                     { ContentKey, QJsonObject{ { "algorithm"_ls, "m.megolm.v1.aes-sha2"_ls } } } };
+
+    auto roomJson = fullyReadJson(1);
+    roomJson.insert("state"_ls, QJsonObject{ { "events"_ls, QJsonArray{ encryptionJson } } });
+    roomJson.insert("timeline"_ls,
+                    QJsonObject{ { "events"_ls,
+                                   QJsonArray{ messageJson(1), encryptedJson, messageJson(3) } } });
+    room.updateData(SyncRoomData(RoomId, JoinState::Join, roomJson));
+    QVERIFY(room.usesEncryption());
+    // The encrypted event is not notable until it's decrypted
+    QCOMPARE(room.partiallyReadStats().notableCount, qsizetype(1));
+    QCOMPARE(room.unreadStats().notableCount, qsizetype(1));
+
+    QSignalSpy partiallyReadSpy(&room, &Room::partiallyReadStatsChanged);
+    QSignalSpy unreadSpy(&room, &Room::unreadStatsChanged);
+    room.handleRoomKeyEvent(RoomKeyEvent("m.megolm.v1.aes-sha2"_ls, RoomId,
+                                         QString::fromLatin1(megolmSession.sessionId()),
+                                         QString::fromLatin1(sessionKey)),
+                            Sender, "olmsession", "senderkey", "senderedkey");
+    QVERIFY(room.findInTimeline(eventId(2))->viewAs<RoomMessageEvent>() != nullptr);
+    QCOMPARE(room.partiallyReadStats().notableCount, qsizetype(2));
+    QCOMPARE(room.unreadStats().notableCount, qsizetype(2));
+    QCOMPARE(partiallyReadSpy.size(), 1);
+    QCOMPARE(unreadSpy.size(), 1);
+
+    // Moving the marker takes off exactly what the index has for the passed events
+    room.updateData(SyncRoomData(RoomId, JoinState::Join, fullyReadJson(3)));
+    QCOMPARE(room.partiallyReadStats().notableCount, qsizetype(0));
+    QCOMPARE(room.unreadStats().notableCount, qsizetype(0));
+}
+
+QTEST_GUILESS_MAIN(TestEventStats)
+#include "testeventstats.moc"
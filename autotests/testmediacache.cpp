@@ -0,0 +1,131 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/mediacache.h>
+#include <Quotient/mxcreply.h>
+
+#include <Quotient/events/filesourceinfo.h>
+
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTemporaryFile>
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class TestMediaCache : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanup();
+    void storeAndOpen();
+    void evictLeastRecentlyUsed();
+    void checkEncryptedHash();
+    void rejectInvalidMetadata();
+
+private:
+    QTemporaryDir cacheDir;
+};
+
+namespace {
+void store(const MediaCache::Key& key, const QByteArray& content)
+{
+    auto stagingFile = MediaCache::instance().makeStagingFile();
+    QVERIFY(stagingFile != nullptr);
+    QCOMPARE(stagingFile->write(content), content.size());
+    MediaCache::instance().store(key, *stagingFile);
+}
+
+const MediaCache::Key ItemA{ "example.org"_ls, "aaa"_ls };
+const MediaCache::Key ItemB{ "example.org"_ls, "bbb"_ls };
+const MediaCache::Key ItemC{ "example.org"_ls, "ccc"_ls };
+} // namespace
+
+void TestMediaCache::initTestCase()
+{
+    QVERIFY(cacheDir.isValid());
+    MediaCache::instance().setLocation(cacheDir.path());
+}
+
+void TestMediaCache::cleanup()
+{
+    MediaCache::instance().clear();
+    MediaCache::instance().setMaxSize(MediaCache::DefaultMaxSize);
+}
+
+void TestMediaCache::storeAndOpen()
+{
+    auto& cache = MediaCache::instance();
+    store(ItemA, QByteArrayLiteral("full size"));
+    store({ ItemA.serverName, ItemA.mediaId, { 64, 64 } }, QByteArrayLiteral("thumbnail"));
+    QCOMPARE(cache.size(), 18);
+
+    auto file = cache.open(ItemA);
+    QVERIFY(file != nullptr);
+    QCOMPARE(file->readAll(), QByteArrayLiteral("full size"));
+    file = cache.open({ ItemA.serverName, ItemA.mediaId, { 64, 64 } });
+    QVERIFY(file != nullptr);
+    QCOMPARE(file->readAll(), QByteArrayLiteral("thumbnail"));
+    QVERIFY(cache.open(ItemB) == nullptr);
+    QCOMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 2); // No staging leftovers
+}
+
+void TestMediaCache::evictLeastRecentlyUsed()
+{
+    auto& cache = MediaCache::instance();
+    cache.setMaxSize(250);
+    store(ItemA, QByteArray(100, 'a'));
+    store(ItemB, QByteArray(100, 'b'));
+    QVERIFY(cache.open(ItemA) != nullptr); // Now B is the least recently used
+    store(ItemC, QByteArray(100, 'c'));
+    QCOMPARE(cache.size(), 200);
+    QVERIFY(cache.open(ItemA) != nullptr);
+    QVERIFY(cache.open(ItemB) == nullptr);
+    QVERIFY(cache.open(ItemC) != nullptr);
+
+    cache.setMaxSize(150);
+    QCOMPARE(cache.size(), 100);
+    QVERIFY(cache.open(ItemC) != nullptr);
+}
+
+void TestMediaCache::checkEncryptedHash()
+{
+    auto& cache = MediaCache::instance();
+    const auto plainText = QByteArrayLiteral("secret");
+    auto [metadata, cipherText] = encryptFile(plainText);
+    metadata.url = QUrl("mxc://example.org/aaa"_ls);
+    store(ItemA, cipherText);
+    {
+        MxcReply reply(cache.open(ItemA), metadata, ItemA);
+        QCOMPARE(reply.readAll(), plainText);
+        QCOMPARE(reply.error(), QNetworkReply::NoError);
+    }
+    QCOMPARE(cache.size(), qint64(cipherText.size()));
+
+    cipherText[0] = static_cast<char>(cipherText[0] ^ 1);
+    store(ItemA, cipherText);
+    auto file = cache.open(ItemA); // Opening doesn't check the content...
+    QVERIFY(file != nullptr);
+    MxcReply reply(std::move(file), metadata, ItemA);
+    QVERIFY(reply.readAll().isEmpty()); // ...but reading it through does
+    QCOMPARE(reply.error(), QNetworkReply::UnknownContentError);
+    QCOMPARE(cache.size(), 0); // The corrupted item should be gone
+}
+
+void TestMediaCache::rejectInvalidMetadata()
+{
+    auto& cache = MediaCache::instance();
+    auto [metadata, cipherText] = encryptFile(QByteArrayLiteral("secret"));
+    metadata.url = QUrl("mxc://example.org/aaa"_ls);
+    store(ItemA, cipherText);
+
+    metadata.key.k.chop(4); // Too short for AES-256
+    MxcReply reply(cache.open(ItemA), metadata, ItemA);
+    QCOMPARE(reply.error(), QNetworkReply::UnknownContentError);
+    QVERIFY(reply.readAll().isEmpty());
+    // The cached item is fine, it's the metadata that is broken
+    QCOMPARE(cache.size(), qint64(cipherText.size()));
+}
+
+QTEST_GUILESS_MAIN(TestMediaCache)
+#include "testmediacache.moc"
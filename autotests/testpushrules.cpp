@@ -0,0 +1,123 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/connection.h>
+#include <Quotient/pushruleevaluator.h>
+#include <Quotient/room.h>
+
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class TestPushRules : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void evaluate_data();
+    void evaluate();
+
+private:
+    Connection* connection = nullptr;
+    Room* room = nullptr;
+    PushRuleEvaluator evaluator;
+};
+
+namespace {
+const auto RoomId = QStringLiteral("!test:localhost");
+
+const QJsonArray DontNotify{};
+const QJsonArray Notify{ "notify"_ls };
+const QJsonArray Highlight{ "notify"_ls, QJsonObject{ { "set_tweak"_ls, "highlight"_ls } } };
+
+QJsonObject rule(const QString& ruleId, const QJsonArray& actions, QJsonObject extra = {})
+{
+    extra.insert("rule_id"_ls, ruleId);
+    extra.insert("default"_ls, false);
+    extra.insert("enabled"_ls, true);
+    extra.insert("actions"_ls, actions);
+    return extra;
+}
+
+QJsonObject eventMatch(const QString& key, const QString& pattern)
+{
+    return { { "kind"_ls, "event_match"_ls }, { "key"_ls, key }, { "pattern"_ls, pattern } };
+}
+
+QJsonObject eventJson(const QString& type, const QString& sender, const QString& body)
+{
+    return { { TypeKey, type },
+             { "event_id"_ls, "$event:localhost"_ls },
+             { "room_id"_ls, RoomId },
+             { SenderKey, sender },
+             { "origin_server_ts"_ls, 1700000000000 },
+             { ContentKey, QJsonObject{ { "msgtype"_ls, "m.text"_ls }, { "body"_ls, body } } } };
+}
+} // namespace
+
+void TestPushRules::initTestCase()
+{
+    connection = Connection::makeMockConnection("@me:localhost"_ls, false);
+    room = new Room(connection, RoomId, JoinState::Join);
+
+    const auto conditions = [](const QString& key, const QString& pattern) {
+        return QJsonObject{ { "conditions"_ls, QJsonArray{ eventMatch(key, pattern) } } };
+    };
+    const QJsonObject ruleset{
+        { "override"_ls,
+          QJsonArray{ rule(".m.rule.suppress_notices"_ls, DontNotify,
+                           conditions("content.msgtype"_ls, "m.notice"_ls)),
+                      rule("tombstone"_ls, Highlight,
+                           conditions("type"_ls, "m.room.tombstone"_ls)) } },
+        { "content"_ls,
+          QJsonArray{ rule("cake"_ls, Highlight, { { "pattern"_ls, "cake*lie"_ls } }),
+                      rule("pie"_ls, Highlight, { { "pattern"_ls, "pie"_ls } }) } },
+        { "sender"_ls, QJsonArray{ rule("@friend:localhost"_ls, Notify) } },
+        { "underride"_ls,
+          QJsonArray{ rule("message"_ls, Notify, conditions("type"_ls, "m.room.message"_ls)) } }
+    };
+    evaluator.setRuleset(fromJson<PushRuleset>(ruleset));
+}
+
+void TestPushRules::cleanupTestCase()
+{
+    delete room;
+    delete connection;
+}
+
+void TestPushRules::evaluate_data()
+{
+    QTest::addColumn<QJsonObject>("json");
+    QTest::addColumn<Notification::Type>("expected");
+
+    const auto msg = "m.room.message"_ls;
+    const auto stranger = "@stranger:localhost"_ls;
+    QTest::newRow("content rule glob")
+        << eventJson(msg, stranger, "The Cake is a lie!"_ls) << Notification::Highlight;
+    QTest::newRow("content rule word") << eventJson(msg, stranger, "Apple pie"_ls)
+                                       << Notification::Highlight;
+    QTest::newRow("content rule not a word")
+        << eventJson(msg, stranger, "Pies"_ls) << Notification::Basic; // underride
+    QTest::newRow("sender rule") << eventJson(msg, "@friend:localhost"_ls, "Hi"_ls)
+                                 << Notification::Basic;
+    QTest::newRow("typed override") << eventJson("m.room.tombstone"_ls, stranger, "Bye"_ls)
+                                    << Notification::Highlight;
+    QTest::newRow("no rule") << eventJson("m.reaction"_ls, stranger, {}) << Notification::None;
+
+    auto notice = eventJson(msg, stranger, "The cake is a lie"_ls);
+    notice[ContentKey] = QJsonObject{ { "msgtype"_ls, "m.notice"_ls },
+                                      { "body"_ls, "The cake is a lie"_ls } };
+    QTest::newRow("override without notify") << notice << Notification::None;
+}
+
+void TestPushRules::evaluate()
+{
+    QFETCH(QJsonObject, json);
+    QFETCH(Notification::Type, expected);
+    const auto event = loadEvent<RoomEvent>(json);
+    QVERIFY(event != nullptr);
+    QCOMPARE(evaluator.evaluate(room, *event).type, expected);
+}
+
+QTEST_GUILESS_MAIN(TestPushRules)
+#include "testpushrules.moc"
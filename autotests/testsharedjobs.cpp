@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/connectiondata.h>
+
+#include <Quotient/jobs/mediathumbnailjob.h>
+
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class TestSharedJobs : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void abandonOneOfTwo();
+    void abandonAll();
+};
+
+namespace {
+const QUrl RequestUrl{ "https://example.org/_matrix/media/thumbnail"_ls };
+
+auto* makeJob() { return new MediaThumbnailJob("example.org"_ls, "media"_ls, { 32, 32 }); }
+
+//! Start a source job that stays in the queue until its result is set by hand
+auto* startSourceJob(ConnectionData& data)
+{
+    auto* sourceJob = new Mocked<MediaThumbnailJob>("example.org"_ls, "media"_ls, QSize(32, 32));
+    sourceJob->initiate(&data, false);
+    return sourceJob;
+}
+} // namespace
+
+void TestSharedJobs::abandonOneOfTwo()
+{
+    ConnectionData data(QUrl("https://example.org"_ls));
+    data.limitRate(std::chrono::hours(1)); // Don't let anything go to the network
+    auto* sourceJob = startSourceJob(data);
+    QVERIFY(isJobPending(sourceJob));
+
+    auto* firstJob = makeJob();
+    data.addInFlightGet(RequestUrl, sourceJob, firstJob);
+    auto* secondJob = makeJob();
+    QVERIFY(data.shareInFlightGet(RequestUrl, secondJob));
+    QCOMPARE(data.coalescedRequestsCount(), 1);
+    QVERIFY(isJobPending(firstJob));
+    QVERIFY(isJobPending(secondJob));
+
+    QSignalSpy firstResultSpy(firstJob, &BaseJob::result);
+    QSignalSpy secondSuccessSpy(secondJob, &BaseJob::success);
+    firstJob->abandon();
+    // The other requester still waits for the same request
+    QVERIFY(isJobPending(sourceJob));
+    QVERIFY(isJobPending(secondJob));
+
+    sourceJob->setResult({});
+    QVERIFY(secondSuccessSpy.wait());
+    QCOMPARE(firstResultSpy.size(), 0);
+}
+
+void TestSharedJobs::abandonAll()
+{
+    ConnectionData data(QUrl("https://example.org"_ls));
+    data.limitRate(std::chrono::hours(1));
+    QPointer<BaseJob> sourceJob = startSourceJob(data);
+
+    auto* firstJob = makeJob();
+    data.addInFlightGet(RequestUrl, sourceJob, firstJob);
+    auto* secondJob = makeJob();
+    QVERIFY(data.shareInFlightGet(RequestUrl, secondJob));
+
+    firstJob->abandon();
+    QVERIFY(isJobPending(sourceJob));
+    secondJob->abandon();
+    // No one needs the request any more
+    QVERIFY(sourceJob);
+    QVERIFY(sourceJob->status().code == BaseJob::Abandoned);
+
+    // Abandoned requests are not shared
+    auto* thirdJob = makeJob();
+    QVERIFY(!data.shareInFlightGet(RequestUrl, thirdJob));
+    QVERIFY(!isJobPending(thirdJob));
+    thirdJob->deleteLater();
+}
+
+QTEST_GUILESS_MAIN(TestSharedJobs)
+#include "testsharedjobs.moc"
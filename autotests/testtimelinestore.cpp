@@ -0,0 +1,172 @@
+// SPDX-FileCopyrightText: 2024 Quotient contributors
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <Quotient/timelinestore.h>
+
+#include <Quotient/util.h>
+
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+using namespace Quotient;
+
+class TestTimelineStore : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void saveAndLoad();
+    void sizeLimit();
+    void removeRoom();
+    void queuedWrites();
+    void initialEndSeq();
+
+private:
+    QTemporaryDir storeDir;
+    std::unique_ptr<TimelineStore> store;
+};
+
+namespace {
+const auto RoomA = QStringLiteral("!a:example.org");
+const auto RoomB = QStringLiteral("!b:example.org");
+const auto Token = QStringLiteral("token");
+
+QString eventId(int n) { return QStringLiteral("$event%1:example.org").arg(n); }
+
+//! Make events with ids from \p first to \p last, the oldest first
+QJsonArray makeEvents(int first, int last)
+{
+    QJsonArray events;
+    for (auto n = first; n <= last; ++n)
+        events.append(
+            QJsonObject{ { "type"_ls, "m.room.message"_ls },
+                         { "event_id"_ls, eventId(n) },
+                         { "content"_ls, QJsonObject{ { "body"_ls, QString::number(n) } } } });
+    return events;
+}
+
+QStringList idsOf(const TimelineStore::CachedEvents& events)
+{
+    QStringList ids;
+    for (const auto& [seq, json] : events)
+        ids.append(json.value("event_id"_ls).toString());
+    return ids;
+}
+} // namespace
+
+void TestTimelineStore::initTestCase() { QVERIFY(storeDir.isValid()); }
+
+void TestTimelineStore::init()
+{
+    store = std::make_unique<TimelineStore>(storeDir.filePath("timeline.db3"_ls),
+                                            "TestTimelineStore"_ls);
+}
+
+void TestTimelineStore::cleanup()
+{
+    store->clear();
+    store.reset();
+}
+
+void TestTimelineStore::saveAndLoad()
+{
+    QCOMPARE(store->endSeq(RoomA), qint64(0));
+    QVERIFY(store->prevBatch(RoomA) == QString()); // Unknown, but there may be more history
+
+    QVERIFY(!store->saveEvents(RoomA, 0, makeEvents(1, 3), 10));
+    store->setPrevBatch(RoomA, Token);
+
+    // Reopen the store to make sure it's all on disk
+    store.reset();
+    init();
+    QCOMPARE(store->endSeq(RoomA), qint64(3));
+    const auto events = store->loadEvents(RoomA, 3, 10);
+    QCOMPARE(idsOf(events), QStringList({ eventId(3), eventId(2), eventId(1) }));
+    QCOMPARE(events.front().first, qint64(2));
+    QCOMPARE(events.front().second, makeEvents(3, 3).first().toObject());
+    QVERIFY(store->prevBatch(RoomA) == Token);
+
+    // Loading goes backwards from the given sequence number
+    QCOMPARE(idsOf(store->loadEvents(RoomA, 2, 1)), QStringList({ eventId(2) }));
+
+    // Saving over existing events replaces them
+    QVERIFY(!store->saveEvents(RoomA, 2, makeEvents(4, 5), 10));
+    QCOMPARE(store->endSeq(RoomA), qint64(4));
+    QCOMPARE(idsOf(store->loadEvents(RoomA, 4, 10)),
+             QStringList({ eventId(5), eventId(4), eventId(2), eventId(1) }));
+
+    store->setPrevBatch(RoomA, std::nullopt);
+    QVERIFY(!store->prevBatch(RoomA).has_value());
+}
+
+void TestTimelineStore::sizeLimit()
+{
+    QVERIFY(store->saveEvents(RoomA, 0, makeEvents(1, 5), 3));
+    QCOMPARE(store->endSeq(RoomA), qint64(5));
+    QCOMPARE(idsOf(store->loadEvents(RoomA, 5, 10)),
+             QStringList({ eventId(5), eventId(4), eventId(3) }));
+
+    QVERIFY(store->saveEvents(RoomA, 5, makeEvents(6, 6), 3));
+    QCOMPARE(idsOf(store->loadEvents(RoomA, 6, 10)),
+             QStringList({ eventId(6), eventId(5), eventId(4) }));
+
+    // Nothing is dropped as long as the limit is not exceeded
+    QVERIFY(!store->saveEvents(RoomB, 0, makeEvents(7, 8), 3));
+    QCOMPARE(store->loadEvents(RoomB, 2, 10).size(), size_t(2));
+}
+
+void TestTimelineStore::removeRoom()
+{
+    store->saveEvents(RoomA, 0, makeEvents(1, 2), 10);
+    store->setPrevBatch(RoomA, std::nullopt);
+    store->saveEvents(RoomB, 0, makeEvents(3, 4), 10);
+    store->setPrevBatch(RoomB, Token);
+
+    store->clearRoom(RoomA);
+    QCOMPARE(store->endSeq(RoomA), qint64(0));
+    QVERIFY(store->loadEvents(RoomA, 2, 10).empty());
+    QVERIFY(store->prevBatch(RoomA) == QString());
+
+    // Other rooms are left intact
+    QCOMPARE(idsOf(store->loadEvents(RoomB, 2, 10)), QStringList({ eventId(4), eventId(3) }));
+    QVERIFY(store->prevBatch(RoomB) == Token);
+}
+
+void TestTimelineStore::queuedWrites()
+{
+    store->enqueueWrites([](TimelineStore& s) {
+        s.transaction();
+        s.saveEvents(RoomA, 0, makeEvents(1, 2), 10);
+        s.setPrevBatch(RoomA, Token);
+        s.commit();
+    });
+    store->enqueueWrites([](TimelineStore& s) { s.saveEvents(RoomA, 2, makeEvents(3, 3), 10); });
+    // Reading waits for the queued writes
+    QCOMPARE(idsOf(store->loadEvents(RoomA, 3, 10)),
+             QStringList({ eventId(3), eventId(2), eventId(1) }));
+    QVERIFY(store->prevBatch(RoomA) == Token);
+
+    store->enqueueWrites([](TimelineStore& s) { s.clearRoom(RoomA); });
+    QCOMPARE(store->endSeq(RoomA), qint64(0));
+}
+
+void TestTimelineStore::initialEndSeq()
+{
+    store->saveEvents(RoomA, 0, makeEvents(1, 2), 10);
+    store->saveEvents(RoomB, 0, makeEvents(3, 5), 10);
+    QCOMPARE(store->initialEndSeq(RoomA), qint64(2));
+    QCOMPARE(store->initialEndSeq(RoomB), qint64(3));
+    QCOMPARE(store->initialEndSeq("!c:example.org"_ls), qint64(0));
+
+    // Later writes don't change the numbers, except clearing the room
+    store->enqueueWrites([](TimelineStore& s) { s.saveEvents(RoomA, 2, makeEvents(6, 6), 10); });
+    QCOMPARE(store->initialEndSeq(RoomA), qint64(2));
+    store->enqueueClearRoom(RoomB);
+    QCOMPARE(store->initialEndSeq(RoomB), qint64(0));
+    QCOMPARE(store->endSeq(RoomA), qint64(3));
+    QCOMPARE(store->endSeq(RoomB), qint64(0));
+}
+
+QTEST_GUILESS_MAIN(TestTimelineStore)
+#include "testtimelinestore.moc"